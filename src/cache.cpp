@@ -0,0 +1,308 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <boost/endian/conversion.hpp>
+#include <cstring>
+
+#include "configuration.hpp"
+#include "logging.hpp"
+
+namespace endian = boost::endian;
+using std::string;
+using std::chrono::duration_cast;
+using std::chrono::seconds;
+
+namespace dnstoy {
+
+namespace {
+
+constexpr auto message_offset = offsetof(dns::RawTcpMessage, message);
+// rfc2308 5: negative answers are cached for at most 3 hours
+constexpr uint32_t max_negative_ttl = 3 * 60 * 60;
+// sizes the frequency sketch from the memory limit
+constexpr size_t average_entry_size = 256;
+
+inline void AppendUint16(string& key, uint16_t value) {
+  key.push_back(static_cast<char>(value >> 8));
+  key.push_back(static_cast<char>(value & 0xff));
+}
+
+}  // namespace
+
+Cache::Cache()
+    : memory_limit_(Configuration::get("cache-memory-limit").as<uint32_t>()),
+      prefetch_threshold_(
+          Configuration::get("cache-prefetch-threshold").as<uint32_t>()),
+      stale_window_(Configuration::get("cache-stale-window").as<uint32_t>()),
+      sketch_(memory_limit_ / average_entry_size) {}
+
+bool Cache::MakeKey(const dns::Message& query, string& key) {
+  if (query.header.is_response ||
+      query.header.operation_code !=
+          static_cast<int16_t>(dns::OPCODE::QUERY) ||
+      query.questions.size() != 1) {
+    return false;
+  }
+  auto& question = query.questions.front();
+  key.clear();
+  key.reserve(question.name.size() + 8);
+  for (auto c : question.name) {
+    key.push_back(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+  }
+  key.push_back('\0');
+  AppendUint16(key, question.type);
+  AppendUint16(key, question.the_class);
+  // RD and the AD/CD bits in Z change what upstream answers
+  key.push_back(static_cast<char>((query.header.is_recursion_desired << 3) |
+                                  query.header.z));
+
+  for (auto& record : query.additional) {
+    if (record.type != static_cast<uint16_t>(dns::TYPE::OPT)) {
+      continue;
+    }
+    // rfc6891 6.1.3: DO bit is the highest bit of the lower 16 bits of TTL
+    auto do_bit = (record.normal_type.ttl >> 15) & 1;
+    key.push_back(static_cast<char>(1 | (do_bit << 1)));
+    auto& rdata = record.rdata;
+    size_t offset = 0;
+    while (offset + sizeof(dns::EDNSOption) <= rdata.size()) {
+      auto option =
+          reinterpret_cast<const dns::EDNSOption*>(rdata.data() + offset);
+      size_t option_size =
+          sizeof(dns::EDNSOption) + endian::big_to_native(option->length);
+      if (offset + option_size > rdata.size()) {
+        break;
+      }
+      if (endian::big_to_native(option->code) ==
+          dns::EDNSOption::CLIENT_SUBNET) {
+        key.append(reinterpret_cast<const char*>(rdata.data() + offset),
+                   option_size);
+      }
+      offset += option_size;
+    }
+    break;
+  }
+  return true;
+}
+
+Cache::LookupResult Cache::Lookup(const string& key, QueryContext& query,
+                                  std::vector<uint8_t>& refresh_query) {
+  sketch_.Increment(std::hash<string>()(key));
+  auto i = index_.find(key);
+  if (i == index_.end()) {
+    statistics_.misses++;
+    return LookupResult::miss;
+  }
+  auto slot_index = i->second;
+  auto& slot = slots_[slot_index];
+  auto now = clock::now();
+  if (now >= slot.expire_time) {
+    statistics_.misses++;
+    if (now < slot.expire_time + stale_window_) {
+      return LookupResult::stale;
+    }
+    Evict(slot_index);
+    return LookupResult::miss;
+  }
+  statistics_.hits++;
+  slot.referenced = true;
+  auto result = LookupResult::hit;
+  if (prefetch_threshold_ && !slot.refreshing &&
+      (slot.expire_time - now) * 100 <
+          (slot.expire_time - slot.stored_time) * prefetch_threshold_) {
+    slot.refreshing = true;
+    statistics_.prefetches++;
+    refresh_query.swap(query.raw_message);
+    result = LookupResult::hit_and_refresh;
+  }
+  uint32_t elapsed = duration_cast<seconds>(now - slot.stored_time).count();
+  WriteAnswer(slot, query, [elapsed](uint32_t ttl) { return ttl - elapsed; });
+  return result;
+}
+
+bool Cache::LookupStale(const string& key, QueryContext& query) {
+  auto i = index_.find(key);
+  if (i == index_.end()) {
+    return false;
+  }
+  auto& slot = slots_[i->second];
+  if (clock::now() >= slot.expire_time + stale_window_) {
+    return false;
+  }
+  statistics_.stale_hits++;
+  WriteAnswer(slot, query, [](uint32_t) { return stale_ttl; });
+  return true;
+}
+
+template <typename TTLFunction>
+void Cache::WriteAnswer(const Slot& slot, QueryContext& query,
+                        TTLFunction&& ttl_function) {
+  auto& buffer = query.raw_message;
+  buffer.assign(slot.data.get(), slot.data.get() + slot.message_size);
+  dns::MessageEncoder::RewriteIDToTcpMessage(buffer.data(), buffer.size(),
+                                             query.query.header.id);
+  auto message = buffer.data() + message_offset;
+  // answers echo the question, keep the letter case sent by the client as
+  // some resolvers use it as extra entropy (draft-vixie-dnsext-dns0x20)
+  dns::MessageEncoder::RewriteQuestionNameCaseToTcpMessage(
+      buffer.data(), buffer.size(), query.query.questions.front().name);
+  auto ttl_offsets = slot.data.get() + slot.message_size;
+  for (size_t j = 0; j < slot.ttl_offset_count; j++) {
+    uint16_t offset;
+    memcpy(&offset, ttl_offsets + j * sizeof(offset), sizeof(offset));
+    uint32_t ttl;
+    memcpy(&ttl, message + offset, sizeof(ttl));
+    ttl = endian::native_to_big(ttl_function(endian::big_to_native(ttl)));
+    memcpy(message + offset, &ttl, sizeof(ttl));
+  }
+}
+
+void Cache::Store(const string& key, const std::vector<uint8_t>& answer) {
+  if (answer.size() < message_offset + sizeof(dns::RawHeader)) {
+    return;
+  }
+  auto message = answer.data() + message_offset;
+  auto message_size = answer.size() - message_offset;
+  auto& header = *reinterpret_cast<const dns::RawHeader*>(message);
+  auto rcode = (header.FLAGS & dns::RawHeader::Flag::RCODE_mask) >>
+               dns::RawHeader::Flag::RCODE_offset;
+  if ((header.FLAGS & dns::RawHeader::Flag::TC_mask) ||
+      (rcode != static_cast<uint16_t>(dns::RCODE::SUCCESS) &&
+       rcode != static_cast<uint16_t>(dns::RCODE::NAME_ERROR))) {
+    return;
+  }
+
+  auto& ttl_view = ttl_view_;
+  auto result = dns::MessageDecoder::ViewTTL(message, message_size, ttl_view);
+  if (result != dns::MessageDecoder::ResultType::good ||
+      ttl_view.offsets.empty()) {
+    return;
+  }
+  auto ttl = ttl_view.minimum_ttl;
+  uint16_t soa_ttl_offset = 0;
+  // rfc2308 1: NXDOMAIN, or NODATA which is NOERROR without answer
+  if (rcode == static_cast<uint16_t>(dns::RCODE::NAME_ERROR) ||
+      !header.ANCOUNT) {
+    // rfc2308 5: negative answers without SOA SHOULD NOT be cached
+    if (!ttl_view.soa_ttl_offset) {
+      return;
+    }
+    ttl = std::min({ttl, ttl_view.negative_ttl, max_negative_ttl});
+    soa_ttl_offset = ttl_view.soa_ttl_offset;
+  }
+  if (ttl == 0) {
+    return;
+  }
+  auto& ttl_offsets = ttl_view.offsets;
+  auto memory_size = sizeof(Slot) + key.size() + answer.size() +
+                     ttl_offsets.size() * sizeof(uint16_t);
+  if (memory_size > memory_limit_) {
+    return;
+  }
+
+  auto i = index_.find(key);
+  if (i != index_.end()) {
+    // refresh an existing entry, it keeps its slot
+    auto slot_index = i->second;
+    auto& slot = slots_[slot_index];
+    statistics_.memory_size -= slot.memory_size();
+    Fill(slot, answer, ttl_offsets, ttl, soa_ttl_offset);
+    statistics_.memory_size += slot.memory_size();
+    while (statistics_.memory_size > memory_limit_) {
+      auto victim = NextVictim();
+      if (victim != slot_index) {
+        Evict(victim);
+        statistics_.evictions++;
+      }
+    }
+    return;
+  }
+
+  auto hash = std::hash<string>()(key);
+  auto now = clock::now();
+  while (statistics_.memory_size + memory_size > memory_limit_) {
+    auto victim = NextVictim();
+    auto& victim_slot = slots_[victim];
+    if (now < victim_slot.expire_time) {
+      if (sketch_.Frequency(hash) <= sketch_.Frequency(victim_slot.hash)) {
+        statistics_.rejections++;
+        return;
+      }
+      statistics_.evictions++;
+    }
+    Evict(victim);
+  }
+
+  uint32_t slot_index;
+  if (free_slots_.empty()) {
+    slot_index = slots_.size();
+    slots_.emplace_back();
+  } else {
+    slot_index = free_slots_.back();
+    free_slots_.pop_back();
+  }
+  auto& slot = slots_[slot_index];
+  slot.key = &index_.emplace(key, slot_index).first->first;
+  slot.hash = hash;
+  Fill(slot, answer, ttl_offsets, ttl, soa_ttl_offset);
+  statistics_.memory_size += slot.memory_size();
+  statistics_.entries++;
+  statistics_.insertions++;
+  LOG_TRACE(<< "cached " << key.c_str() << " for " << ttl << "s");
+}
+
+void Cache::Fill(Slot& slot, const std::vector<uint8_t>& answer,
+                 const std::vector<uint16_t>& ttl_offsets, uint32_t ttl,
+                 uint16_t soa_ttl_offset) {
+  auto data_size = answer.size() + ttl_offsets.size() * sizeof(uint16_t);
+  if (!slot.data ||
+      slot.message_size + slot.ttl_offset_count * sizeof(uint16_t) !=
+          data_size) {
+    slot.data.reset(new uint8_t[data_size]);
+  }
+  memcpy(slot.data.get(), answer.data(), answer.size());
+  memcpy(slot.data.get() + answer.size(), ttl_offsets.data(),
+         ttl_offsets.size() * sizeof(uint16_t));
+  if (soa_ttl_offset) {
+    // rfc2308 3: the SOA of a negative answer tells how long it is cached
+    auto big_endian_ttl = endian::native_to_big(ttl);
+    memcpy(slot.data.get() + message_offset + soa_ttl_offset, &big_endian_ttl,
+           sizeof(big_endian_ttl));
+  }
+  slot.message_size = answer.size();
+  slot.ttl_offset_count = ttl_offsets.size();
+  slot.refreshing = false;
+  slot.stored_time = clock::now();
+  slot.expire_time = slot.stored_time + seconds(ttl);
+}
+
+uint32_t Cache::NextVictim() {
+  // terminates within two rounds as the hand clears reference bits on its way
+  while (true) {
+    if (clock_hand_ >= slots_.size()) {
+      clock_hand_ = 0;
+    }
+    auto& slot = slots_[clock_hand_++];
+    if (!slot.key) {
+      continue;
+    }
+    if (slot.referenced) {
+      slot.referenced = false;
+      continue;
+    }
+    return clock_hand_ - 1;
+  }
+}
+
+void Cache::Evict(uint32_t slot_index) {
+  auto& slot = slots_[slot_index];
+  statistics_.memory_size -= slot.memory_size();
+  statistics_.entries--;
+  index_.erase(index_.find(*slot.key));
+  slot.key = nullptr;
+  slot.referenced = false;
+  slot.data.reset();
+  free_slots_.push_back(slot_index);
+}
+
+}  // namespace dnstoy
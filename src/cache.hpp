@@ -0,0 +1,116 @@
+#ifndef DNSTOY_CACHE_H_
+#define DNSTOY_CACHE_H_
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dns.hpp"
+#include "frequency_sketch.hpp"
+#include "query.hpp"
+
+namespace dnstoy {
+
+// Answer cache in front of the remote servers.
+// Answers are kept as received (dns::RawTcpMessage format) together with the
+// offsets of their TTL fields, a hit copies the bytes and patches ID, question
+// name case and TTLs in place, it never re-encodes a message.
+// Negative answers (NXDOMAIN / NODATA) are cached by their SOA (rfc2308).
+// Memory is bounded by cache-memory-limit: a new answer only replaces the
+// victim chosen by CLOCK if the frequency sketch has seen its key more often
+// than the victim's (TinyLFU), so one-hit names can not flush the hot set.
+// thread-unsafe, designed for thread_local use
+class Cache {
+ public:
+  struct Statistics {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+    // answers not admitted as their key is less popular than the victim
+    uint64_t rejections = 0;
+    // hits that started a refresh of an entry close to expiry
+    uint64_t prefetches = 0;
+    // expired answers served as remote servers did not answer in time
+    uint64_t stale_hits = 0;
+    size_t entries = 0;
+    size_t memory_size = 0;
+  };
+
+  // stale: missed, but an expired answer is kept for LookupStale
+  enum class LookupResult { miss, hit, hit_and_refresh, stale };
+
+  static inline Cache& get() {
+    static thread_local Cache object;
+    return object;
+  }
+
+  bool enabled() const { return memory_limit_ != 0; }
+  const Statistics& statistics() const { return statistics_; }
+  // builds the key from normalized question and the EDNS bits that change
+  // the answer, returns false if the query is not cacheable
+  static bool MakeKey(const dns::Message& query, std::string& key);
+  // on hit, writes the answer for query to query.raw_message.
+  // If the hit entry is within cache-prefetch-threshold of its expiry and no
+  // refresh is running yet, the raw query is moved to refresh_query first and
+  // hit_and_refresh is returned, the caller should resolve it and Store the
+  // fresh answer.
+  LookupResult Lookup(const std::string& key, QueryContext& query,
+                      std::vector<uint8_t>& refresh_query);
+  // rfc8767: writes an answer expired less than cache-stale-window ago,
+  // with its TTLs set to stale_ttl
+  bool LookupStale(const std::string& key, QueryContext& query);
+  void Store(const std::string& key, const std::vector<uint8_t>& answer);
+
+ private:
+  using clock = std::chrono::steady_clock;
+  // rfc8767 4: 30 seconds is the recommended TTL of stale answers
+  static constexpr uint32_t stale_ttl = 30;
+  // one allocation per entry, the message is followed by its TTL offsets
+  struct Slot {
+    // points to the key stored in index_, nullptr if the slot is free
+    const std::string* key = nullptr;
+    uint64_t hash = 0;
+    std::unique_ptr<uint8_t[]> data;
+    uint32_t message_size = 0;
+    uint16_t ttl_offset_count = 0;
+    // CLOCK reference bit, set on hit and cleared when the hand passes by
+    bool referenced = false;
+    bool refreshing = false;
+    clock::time_point stored_time;
+    clock::time_point expire_time;
+
+    size_t memory_size() const {
+      return sizeof(Slot) + key->size() + message_size +
+             ttl_offset_count * sizeof(uint16_t);
+    }
+  };
+
+  size_t memory_limit_;
+  // percentage of TTL left at which a hit triggers refresh, 0 to disable
+  uint32_t prefetch_threshold_;
+  std::chrono::seconds stale_window_;
+  std::unordered_map<std::string, uint32_t> index_;
+  std::vector<Slot> slots_;
+  std::vector<uint32_t> free_slots_;
+  size_t clock_hand_ = 0;
+  FrequencySketch sketch_;
+  dns::TTLView ttl_view_;
+  Statistics statistics_;
+
+  Cache();
+  template <typename TTLFunction>
+  void WriteAnswer(const Slot& slot, QueryContext& query,
+                   TTLFunction&& ttl_function);
+  // soa_ttl_offset: SOA of a negative answer, its TTL is lowered to ttl
+  void Fill(Slot& slot, const std::vector<uint8_t>& answer,
+            const std::vector<uint16_t>& ttl_offsets, uint32_t ttl,
+            uint16_t soa_ttl_offset);
+  uint32_t NextVictim();
+  void Evict(uint32_t slot_index);
+};
+
+}  // namespace dnstoy
+#endif  // DNSTOY_CACHE_H_
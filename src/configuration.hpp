@@ -45,13 +45,84 @@ class Configuration {
     add_configuration_option("listen-port",
                              bpo::value<uint16_t>()->default_value(53),
                              "server listen port");
+    add_configuration_option(
+        "worker-threads", bpo::value<uint32_t>()->default_value(1),
+        "number of worker threads, every worker runs its own listeners and "
+        "remote server connections, 0 for one worker per cpu core");
     add_configuration_option("udp-paylad-size-limit",
                              bpo::value<uint16_t>()->default_value(65507),
                              "udp payload size limit should between "
                              "4096(rfc5625) ~ 65507(max udp payload size)");
+    add_configuration_option(
+        "io-backend", bpo::value<string>()->default_value("asio"),
+        "io backend of the listeners: asio | io_uring");
+    add_configuration_option(
+        "udp-batch-size", bpo::value<uint16_t>()->default_value(32),
+        "maximum datagrams received by one recvmmsg or sent by one sendmmsg "
+        "on the udp listener, 1 to disable batching");
     add_configuration_option("query-timeout",
                              bpo::value<uint32_t>()->default_value(10000),
                              "timeout for every query in milliseconds");
+    add_configuration_option(
+        "connections-per-server", bpo::value<uint16_t>()->default_value(2),
+        "tls or tcp connections every worker keeps to every remote server, "
+        "queries go to the one with least outstanding queries");
+    add_configuration_option(
+        "server-selection", bpo::value<string>()->default_value("p2c"),
+        "strategy picking the remote server of every query: p2c, the one of "
+        "two random servers with lower estimated delay x outstanding queries "
+        "| least-latency, random servers weighted by inverse estimated delay");
+    add_configuration_option(
+        "hedge-percentile", bpo::value<uint16_t>()->default_value(95),
+        "percentile of the recent response times of the selected remote "
+        "server after which a query still unanswered is sent to another too");
+    add_configuration_option(
+        "hedge-budget", bpo::value<uint16_t>()->default_value(5),
+        "percentage of queries that may be sent to a second remote server by "
+        "hedging, 0 to disable hedging");
+    add_configuration_option(
+        "keep-warm-servers", bpo::value<uint16_t>()->default_value(0),
+        "number of the fastest remote servers every worker connects to on "
+        "start and keeps connected even when idle, 0 to connect on demand");
+    add_configuration_option(
+        "keep-warm-interval", bpo::value<uint32_t>()->default_value(15),
+        "seconds of idle after which a kept warm connection is probed, also "
+        "the interval the fastest servers are picked again");
+    add_configuration_option(
+        "tls-session-file", bpo::value<string>()->default_value(""),
+        "file the tls sessions of remote servers are saved to on exit and "
+        "loaded from on start, empty to keep sessions in memory only");
+    add_configuration_option(
+        "tls-ca-file", bpo::value<string>()->default_value(""),
+        "PEM file of the CA certificates tls and https remote servers are "
+        "verified against instead of the system ones, e.g. of a test server");
+    add_configuration_option(
+        "tls-early-data", bpo::value<bool>()->default_value(false),
+        "send queries queued at connect as TLS 1.3 early data (0-RTT) when "
+        "resuming a session, rejected early data is sent again after the "
+        "handshake");
+    add_configuration_option(
+        "tls-kernel-offload", bpo::value<bool>()->default_value(false),
+        "encrypt queries to remote servers by linux kernel TLS once the TLS "
+        "1.3 handshake is done, falls back to OpenSSL if unavailable");
+    add_configuration_option(
+        "cache-memory-limit",
+        bpo::value<uint32_t>()->default_value(16 * 1024 * 1024),
+        "memory limit in bytes of the answer cache of every worker, 0 to "
+        "disable cache");
+    add_configuration_option(
+        "cache-prefetch-threshold", bpo::value<uint32_t>()->default_value(10),
+        "percentage of TTL left at which a cache hit refreshes the answer in "
+        "background, 0 to disable prefetch");
+    add_configuration_option(
+        "cache-stale-window", bpo::value<uint32_t>()->default_value(86400),
+        "seconds an expired answer is kept to be served when remote servers "
+        "do not answer in time (rfc8767), 0 to disable serve-stale");
+    add_configuration_option(
+        "cache-stale-answer-timeout",
+        bpo::value<uint32_t>()->default_value(1800),
+        "milliseconds to wait for remote servers before an expired answer is "
+        "served");
     add_configuration_option("edns0-client-subnet",
                              bpo::value<string>()->default_value("0.0.0.0/0"),
                              "EDNS0 client subnet [address/range]");
@@ -61,7 +132,7 @@ class Configuration {
             "tls@853/1.0.0.1/cloudflare-dns.com"),
         "foreign dns server format:\n"
         "transport_type1[@port][|transport_type2][/address1][|address2]"
-        "[/hostname],///,...");
+        "[/hostname][/https path],///,...");
     bpo::store(bpo::parse_config_file(variables_["config"].as<string>().c_str(),
                                       configurations),
                variables_);
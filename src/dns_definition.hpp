@@ -1,6 +1,7 @@
 #ifndef DNSTOY_DNS_DEFINITION_H_
 #define DNSTOY_DNS_DEFINITION_H_
 #include <iostream>
+#include <limits>
 #include <string>
 #include <vector>
 
@@ -155,6 +156,25 @@ struct MessageView {
   }
 };
 
+// TTL fields of a raw message, see MessageDecoder::ViewTTL
+struct TTLView {
+  // offsets of every TTL field, OPT records are skipped as their TTL field
+  // carries EDNS flags
+  std::vector<uint16_t> offsets;
+  uint32_t minimum_ttl;
+  // offset of the TTL field of the first SOA record in authority section, 0
+  // if there is none
+  uint16_t soa_ttl_offset;
+  // rfc2308 5: min(SOA TTL, SOA MINIMUM) of that SOA record
+  uint32_t negative_ttl;
+  void reset() {
+    offsets.clear();
+    minimum_ttl = std::numeric_limits<uint32_t>::max();
+    soa_ttl_offset = 0;
+    negative_ttl = 0;
+  }
+};
+
 }  // namespace dns
 }  // namespace dnstoy
 #endif  // DNSTOY_DNS_DEFINITION_H_
\ No newline at end of file
@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <boost/endian/conversion.hpp>
+#include <cstring>
+#include <limits>
 #include <string>
 #include <vector>
 
@@ -385,6 +388,149 @@ MessageDecoder::ResultType MessageDecoder::ReadIDFromTcpMessage(
                                                              read_offset));
   return ResultType::good;
 }
+
+MessageDecoder::ResultType MessageDecoder::ViewTTL(const uint8_t* buffer,
+                                                   size_t buffer_size,
+                                                   TTLView& ttl_view) {
+  ttl_view.reset();
+  if (buffer_size < sizeof(RawHeader) ||
+      buffer_size > std::numeric_limits<uint16_t>::max()) {
+    return ResultType::bad;
+  }
+  auto& header = *reinterpret_cast<const RawHeader*>(buffer);
+  size_t offset = sizeof(RawHeader);
+  auto question_count = endian::big_to_native(header.QDCOUNT);
+  size_t answer_count = endian::big_to_native(header.ANCOUNT);
+  size_t authority_end = answer_count + endian::big_to_native(header.NSCOUNT);
+  size_t resource_record_count =
+      authority_end + endian::big_to_native(header.ARCOUNT);
+
+  for (size_t i = 0; i < question_count; i++) {
+    auto result = DecodeName(nullptr, buffer, buffer_size, offset, false,
+                             offset);
+    if (result != ResultType::good) {
+      return ResultType::bad;
+    }
+    offset += sizeof(RawQuestion) - sizeof(RawQuestion::QNAME);
+  }
+
+  constexpr auto fields_before_rdata_size =
+      sizeof(RawResourceRecord) - sizeof(RawResourceRecord::NAME);
+  for (size_t i = 0; i < resource_record_count; i++) {
+    auto result = DecodeName(nullptr, buffer, buffer_size, offset, false,
+                             offset);
+    if (result != ResultType::good ||
+        offset + fields_before_rdata_size > buffer_size) {
+      return ResultType::bad;
+    }
+    auto raw_record = reinterpret_cast<const RawResourceRecord*>(
+        buffer + offset - sizeof(RawResourceRecord::NAME));
+    auto type = endian::big_to_native(raw_record->TYPE);
+    auto ttl = endian::big_to_native(raw_record->TTL);
+    size_t rdata_size = endian::big_to_native(raw_record->RDLENGTH);
+    size_t ttl_offset = offset + offsetof(RawResourceRecord, TTL) -
+                        sizeof(RawResourceRecord::NAME);
+    offset += fields_before_rdata_size + rdata_size;
+    if (offset > buffer_size) {
+      return ResultType::bad;
+    }
+    if (type == static_cast<uint16_t>(TYPE::OPT)) {
+      continue;
+    }
+    ttl_view.offsets.push_back(ttl_offset);
+    ttl_view.minimum_ttl = std::min(ttl_view.minimum_ttl, ttl);
+
+    // rfc1035 3.3.13: MINIMUM is the last field of SOA RDATA, after two
+    // names and four 32 bit fields
+    constexpr size_t soa_minimum_rdata_size = 2 + 5 * sizeof(uint32_t);
+    if (i >= answer_count && i < authority_end && !ttl_view.soa_ttl_offset &&
+        type == static_cast<uint16_t>(TYPE::SOA) &&
+        rdata_size >= soa_minimum_rdata_size) {
+      uint32_t minimum;
+      memcpy(&minimum, buffer + offset - sizeof(minimum), sizeof(minimum));
+      ttl_view.soa_ttl_offset = ttl_offset;
+      ttl_view.negative_ttl = std::min(ttl, endian::big_to_native(minimum));
+    }
+  }
+  return ResultType::good;
+}
+
+MessageDecoder::ResultType MessageDecoder::FindEDNSRecord(
+    const uint8_t* buffer, size_t buffer_size, size_t& rdata_offset) {
+  if (buffer_size < sizeof(RawHeader) ||
+      buffer_size > std::numeric_limits<uint16_t>::max()) {
+    return ResultType::bad;
+  }
+  auto& header = *reinterpret_cast<const RawHeader*>(buffer);
+  size_t offset = sizeof(RawHeader);
+  auto question_count = endian::big_to_native(header.QDCOUNT);
+  size_t resource_record_count = endian::big_to_native(header.ANCOUNT) +
+                                 endian::big_to_native(header.NSCOUNT) +
+                                 endian::big_to_native(header.ARCOUNT);
+
+  for (size_t i = 0; i < question_count; i++) {
+    auto result = DecodeName(nullptr, buffer, buffer_size, offset, false,
+                             offset);
+    if (result != ResultType::good) {
+      return ResultType::bad;
+    }
+    offset += sizeof(RawQuestion) - sizeof(RawQuestion::QNAME);
+  }
+
+  constexpr auto fields_before_rdata_size =
+      sizeof(RawResourceRecord) - sizeof(RawResourceRecord::NAME);
+  for (size_t i = 0; i < resource_record_count; i++) {
+    auto result = DecodeName(nullptr, buffer, buffer_size, offset, false,
+                             offset);
+    if (result != ResultType::good ||
+        offset + fields_before_rdata_size > buffer_size) {
+      return ResultType::bad;
+    }
+    auto raw_record = reinterpret_cast<const RawResourceRecord*>(
+        buffer + offset - sizeof(RawResourceRecord::NAME));
+    auto type = endian::big_to_native(raw_record->TYPE);
+    size_t rdata_size = endian::big_to_native(raw_record->RDLENGTH);
+    offset += fields_before_rdata_size;
+    if (offset + rdata_size > buffer_size) {
+      return ResultType::bad;
+    }
+    if (type == static_cast<uint16_t>(TYPE::OPT)) {
+      rdata_offset = offset;
+      return ResultType::good;
+    }
+    offset += rdata_size;
+  }
+  return ResultType::indeterminate;
+}
+
+MessageDecoder::ResultType MessageDecoder::FindEDNSOption(
+    const uint8_t* buffer, size_t buffer_size, uint16_t code,
+    size_t& option_offset) {
+  size_t offset;
+  auto result = FindEDNSRecord(buffer, buffer_size, offset);
+  if (result != ResultType::good) {
+    return result;
+  }
+  auto raw_record = reinterpret_cast<const RawResourceRecord*>(
+      buffer + offset - offsetof(RawResourceRecord, RDATA));
+  auto rdata_end = offset + endian::big_to_native(raw_record->RDLENGTH);
+  // rfc6891 6.1.2: RDATA is a sequence of {code, length, data}
+  while (offset + sizeof(EDNSOption) <= rdata_end) {
+    auto option = reinterpret_cast<const EDNSOption*>(buffer + offset);
+    auto option_end =
+        offset + sizeof(EDNSOption) + endian::big_to_native(option->length);
+    if (option_end > rdata_end) {
+      return ResultType::bad;
+    }
+    if (endian::big_to_native(option->code) == code) {
+      option_offset = offset;
+      return ResultType::good;
+    }
+    offset = option_end;
+  }
+  return offset == rdata_end ? ResultType::indeterminate : ResultType::bad;
+}
+
 bool MessageDecoder::IsMessageContainsEDNS(const Message& message) {
   return std::any_of(message.additional.begin(), message.additional.end(),
                      [](const ResourceRecord& record) {
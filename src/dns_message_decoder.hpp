@@ -25,6 +25,16 @@ class MessageDecoder {
   static ResultType ReadIDFromTcpMessage(const uint8_t* buffer,
                                          size_t buffer_size, int16_t& id);
   static bool IsMessageContainsEDNS(const Message& message);
+  static ResultType ViewTTL(const uint8_t* buffer, size_t buffer_size,
+                            TTLView& ttl_view);
+  // rdata_offset: offset of the RDATA of the OPT record in buffer,
+  // returns indeterminate if the message carries no OPT record
+  static ResultType FindEDNSRecord(const uint8_t* buffer, size_t buffer_size,
+                                   size_t& rdata_offset);
+  // option_offset: offset of the option with code in buffer, returns
+  // indeterminate if the message carries no such option
+  static ResultType FindEDNSOption(const uint8_t* buffer, size_t buffer_size,
+                                   uint16_t code, size_t& option_offset);
 
  private:
   enum class FieldType {
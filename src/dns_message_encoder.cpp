@@ -1,5 +1,7 @@
 #include <algorithm>
 #include <boost/endian/conversion.hpp>
+#include <cassert>
+#include <cstring>
 #include <functional>
 #include <limits>
 #include <string>
@@ -191,6 +193,28 @@ MessageEncoder::ResultType MessageEncoder::RewriteIDToTcpMessage(
   return ResultType::good;
 }
 
+MessageEncoder::ResultType MessageEncoder::RewriteQuestionNameCaseToTcpMessage(
+    uint8_t* buffer, size_t buffer_size, const std::string& name) {
+  constexpr auto name_offset =
+      offsetof(dns::RawTcpMessage, message) + sizeof(dns::RawHeader);
+  auto label = buffer + name_offset;
+  auto end = buffer + buffer_size;
+  size_t name_offset_in_string = 0;
+  while (label < end && *label != 0) {
+    if ((*label & RawLabel::Flag::MASK) != RawLabel::Flag::NORMAL) {
+      return ResultType::bad;
+    }
+    size_t length = *label++;
+    if (label + length > end || name_offset_in_string + length > name.size()) {
+      return ResultType::bad;
+    }
+    memcpy(label, name.data() + name_offset_in_string, length);
+    label += length;
+    name_offset_in_string += length + 1;
+  }
+  return ResultType::good;
+}
+
 MessageEncoder::ResultType
 MessageEncoder::EncodeEDNS0ClientSubnetResoureceRecord(
     std::vector<uint8_t>& buffer, uint16_t udp_payload_size,
@@ -255,6 +279,80 @@ MessageEncoder::AppendAdditionalResourceRecordToRawTcpMessage(
   return ResultType::good;
 }
 
+MessageEncoder::ResultType MessageEncoder::AppendEDNSOptionToRawTcpMessage(
+    std::vector<uint8_t>& message_buffer, size_t message_offset,
+    const uint8_t* raw_option, uint16_t raw_option_length) {
+  constexpr auto tcp_header_size = offsetof(RawTcpMessage, message);
+  if (message_buffer.size() < message_offset + tcp_header_size) {
+    return ResultType::bad;
+  }
+  auto message = message_buffer.data() + message_offset + tcp_header_size;
+  size_t rdata_offset;
+  if (MessageDecoder::FindEDNSRecord(
+          message, message_buffer.size() - message_offset - tcp_header_size,
+          rdata_offset) != MessageDecoder::ResultType::good) {
+    return ResultType::bad;
+  }
+  auto tcp_header =
+      reinterpret_cast<RawTcpMessage*>(message_buffer.data() + message_offset);
+  {
+    auto message_length = endian::big_to_native(tcp_header->message_length) +
+                          raw_option_length;
+    SAFE_SET_INT(tcp_header->message_length, message_length);
+  }
+  auto raw_record = reinterpret_cast<RawResourceRecord*>(
+      message + rdata_offset - offsetof(RawResourceRecord, RDATA));
+  size_t rdata_length = endian::big_to_native(raw_record->RDLENGTH);
+  SAFE_SET_INT(raw_record->RDLENGTH, rdata_length + raw_option_length);
+  auto insert_position = message_offset + tcp_header_size + rdata_offset +
+                         rdata_length;
+  message_buffer.insert(message_buffer.begin() + insert_position, raw_option,
+                        raw_option + raw_option_length);
+  return ResultType::good;
+}
+
+MessageEncoder::ResultType MessageEncoder::RemoveEDNSOptionFromRawTcpMessage(
+    std::vector<uint8_t>& message_buffer, uint16_t code) {
+  constexpr auto tcp_header_size = offsetof(RawTcpMessage, message);
+  if (message_buffer.size() < tcp_header_size) {
+    return ResultType::bad;
+  }
+  auto message = message_buffer.data() + tcp_header_size;
+  auto message_size = message_buffer.size() - tcp_header_size;
+  size_t option_offset;
+  auto find_result = MessageDecoder::FindEDNSOption(message, message_size,
+                                                    code, option_offset);
+  if (find_result == MessageDecoder::ResultType::indeterminate) {
+    return ResultType::good;
+  }
+  if (find_result != MessageDecoder::ResultType::good) {
+    return ResultType::bad;
+  }
+  size_t rdata_offset;
+  MessageDecoder::FindEDNSRecord(message, message_size, rdata_offset);
+  auto option = reinterpret_cast<EDNSOption*>(message + option_offset);
+  size_t option_size =
+      sizeof(EDNSOption) + endian::big_to_native(option->length);
+
+  auto tcp_header = reinterpret_cast<RawTcpMessage*>(message_buffer.data());
+  {
+    auto message_length =
+        endian::big_to_native(tcp_header->message_length) - option_size;
+    SAFE_SET_INT(tcp_header->message_length, message_length);
+  }
+  auto raw_record = reinterpret_cast<RawResourceRecord*>(
+      message + rdata_offset - offsetof(RawResourceRecord, RDATA));
+  {
+    auto rdata_length =
+        endian::big_to_native(raw_record->RDLENGTH) - option_size;
+    SAFE_SET_INT(raw_record->RDLENGTH, rdata_length);
+  }
+  auto erase_position =
+      message_buffer.begin() + tcp_header_size + option_offset;
+  message_buffer.erase(erase_position, erase_position + option_size);
+  return ResultType::good;
+}
+
 inline bool EncodeName(MessageEncoderContext& context, const string& name) {
   string::size_type end_offset;
   string::size_type begin_offset = 0;
@@ -1,6 +1,7 @@
 #ifndef DNSTOY_DNS_MESSAGE_ENCODER_H_
 #define DNSTOY_DNS_MESSAGE_ENCODER_H_
 
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -21,12 +22,25 @@ class MessageEncoder {
                              size_t size_limit, size_t& truncated_size);
   static ResultType RewriteIDToTcpMessage(uint8_t* buffer, size_t buffer_size,
                                           int16_t id);
+  // rewrites letter case of the first question name to the one of name,
+  // names must be equal ignoring case
+  static ResultType RewriteQuestionNameCaseToTcpMessage(
+      uint8_t* buffer, size_t buffer_size, const std::string& name);
   static ResultType EncodeEDNS0ClientSubnetResoureceRecord(
       std::vector<uint8_t>& buffer, uint16_t udp_payload_size,
       EDNSOption::ClientSubnet& options, const uint8_t* address);
   static ResultType AppendAdditionalResourceRecordToRawTcpMessage(
       std::vector<uint8_t>& message_buffer, const uint8_t* raw_resource_record,
       uint16_t raw_resource_record_length);
+  // appends raw_option to the OPT record of the tcp message which starts at
+  // message_offset and ends at the end of message_buffer
+  static ResultType AppendEDNSOptionToRawTcpMessage(
+      std::vector<uint8_t>& message_buffer, size_t message_offset,
+      const uint8_t* raw_option, uint16_t raw_option_length);
+  // removes the option with code from the OPT record of the tcp message,
+  // a message without the option is left untouched
+  static ResultType RemoveEDNSOptionFromRawTcpMessage(
+      std::vector<uint8_t>& message_buffer, uint16_t code);
 };
 
 }  // namespace dns
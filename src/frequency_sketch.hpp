@@ -0,0 +1,79 @@
+#ifndef DNSTOY_FREQUENCY_SKETCH_H_
+#define DNSTOY_FREQUENCY_SKETCH_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace dnstoy {
+
+// Count-min sketch with 4 bit counters as used by TinyLFU admission.
+// Every row picks one of the 16 counters packed in a 64 bit word, all
+// counters are halved after sample size increments, so frequencies follow
+// recent popularity instead of all time popularity.
+// thread-unsafe, designed for thread_local use
+class FrequencySketch {
+ public:
+  explicit FrequencySketch(size_t expected_entries) {
+    size_t size = 64;
+    while (size < expected_entries) {
+      size <<= 1;
+    }
+    table_.resize(size, 0);
+    mask_ = size - 1;
+    sample_size_ = size * 10;
+  }
+
+  void Increment(uint64_t hash) {
+    bool added = false;
+    for (size_t row = 0; row < row_count_; row++) {
+      unsigned shift;
+      auto& word = table_[Locate(hash, row, shift)];
+      if (((word >> shift) & 0xf) != 0xf) {
+        word += uint64_t(1) << shift;
+        added = true;
+      }
+    }
+    if (added && ++additions_ >= sample_size_) {
+      Reset();
+    }
+  }
+
+  uint8_t Frequency(uint64_t hash) const {
+    uint8_t frequency = 0xf;
+    for (size_t row = 0; row < row_count_; row++) {
+      unsigned shift;
+      auto word = table_[Locate(hash, row, shift)];
+      frequency = std::min<uint8_t>(frequency, (word >> shift) & 0xf);
+    }
+    return frequency;
+  }
+
+ private:
+  static constexpr size_t row_count_ = 4;
+  std::vector<uint64_t> table_;
+  size_t mask_;
+  size_t sample_size_;
+  size_t additions_ = 0;
+
+  // returns the word index of the counter in row, and its bit offset
+  size_t Locate(uint64_t hash, size_t row, unsigned& shift) const {
+    static constexpr uint64_t seeds[row_count_] = {
+        0xc3a5c85c97cb3127, 0xb492b66fbe98f273, 0x9ae16a3b2f90404f,
+        0xcbf29ce484222325};
+    hash = (hash + seeds[row]) * 0x9e3779b97f4a7c15;
+    hash ^= hash >> 29;
+    shift = (hash >> 60) << 2;
+    return hash & mask_;
+  }
+
+  void Reset() {
+    for (auto& word : table_) {
+      word = (word >> 1) & 0x7777777777777777;
+    }
+    additions_ /= 2;
+  }
+};
+
+}  // namespace dnstoy
+#endif  // DNSTOY_FREQUENCY_SKETCH_H_
@@ -0,0 +1,430 @@
+#include "http2.hpp"
+
+#include <algorithm>
+#include <array>
+#include <boost/endian/conversion.hpp>
+#include <cstring>
+
+namespace endian = boost::endian;
+
+namespace dnstoy {
+namespace http2 {
+
+namespace {
+
+// rfc7541 appendix A
+const std::array<std::pair<std::string_view, std::string_view>, 61>
+    static_table = {{
+        {":authority", ""},
+        {":method", "GET"},
+        {":method", "POST"},
+        {":path", "/"},
+        {":path", "/index.html"},
+        {":scheme", "http"},
+        {":scheme", "https"},
+        {":status", "200"},
+        {":status", "204"},
+        {":status", "206"},
+        {":status", "304"},
+        {":status", "400"},
+        {":status", "404"},
+        {":status", "500"},
+        {"accept-charset", ""},
+        {"accept-encoding", "gzip, deflate"},
+        {"accept-language", ""},
+        {"accept-ranges", ""},
+        {"accept", ""},
+        {"access-control-allow-origin", ""},
+        {"age", ""},
+        {"allow", ""},
+        {"authorization", ""},
+        {"cache-control", ""},
+        {"content-disposition", ""},
+        {"content-encoding", ""},
+        {"content-language", ""},
+        {"content-length", ""},
+        {"content-location", ""},
+        {"content-range", ""},
+        {"content-type", ""},
+        {"cookie", ""},
+        {"date", ""},
+        {"etag", ""},
+        {"expect", ""},
+        {"expires", ""},
+        {"from", ""},
+        {"host", ""},
+        {"if-match", ""},
+        {"if-modified-since", ""},
+        {"if-none-match", ""},
+        {"if-range", ""},
+        {"if-unmodified-since", ""},
+        {"last-modified", ""},
+        {"link", ""},
+        {"location", ""},
+        {"max-forwards", ""},
+        {"proxy-authenticate", ""},
+        {"proxy-authorization", ""},
+        {"range", ""},
+        {"referer", ""},
+        {"refresh", ""},
+        {"retry-after", ""},
+        {"server", ""},
+        {"set-cookie", ""},
+        {"strict-transport-security", ""},
+        {"transfer-encoding", ""},
+        {"user-agent", ""},
+        {"vary", ""},
+        {"via", ""},
+        {"www-authenticate", ""},
+    }};
+
+// rfc7541 appendix B: code lengths of the symbols, the last one is EOS. The
+// code is canonical, codes of the same length are consecutive in symbol
+// order, so the lengths are enough to rebuild it.
+constexpr uint8_t huffman_code_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,  // 0-15
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,  // 16-31
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,  // 32-47
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,  // 48-63
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  // 64-79
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,  // 80-95
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,  // 96-111
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,  // 112-127
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,  // 128-143
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,  // 144-159
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,  // 160-175
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,  // 176-191
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,  // 192-207
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,  // 208-223
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,  // 224-239
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,  // 240-255
+    30,  // 256
+};
+constexpr size_t huffman_max_code_length = 30;
+constexpr uint16_t huffman_eos = 256;
+
+struct HuffmanTable {
+  // first code and first entry in symbols of every code length
+  std::array<uint32_t, huffman_max_code_length + 1> first_code{};
+  std::array<uint16_t, huffman_max_code_length + 1> first_entry{};
+  std::array<uint16_t, huffman_max_code_length + 1> count{};
+  // symbols ordered by code
+  std::array<uint16_t, 257> symbols{};
+
+  HuffmanTable() {
+    for (auto length : huffman_code_lengths) {
+      count[length]++;
+    }
+    uint32_t code = 0;
+    uint16_t entry = 0;
+    for (size_t length = 1; length <= huffman_max_code_length; length++) {
+      first_code[length] = code;
+      first_entry[length] = entry;
+      code = (code + count[length]) << 1;
+      entry += count[length];
+    }
+    auto next_entry = first_entry;
+    for (uint16_t symbol = 0; symbol < symbols.size(); symbol++) {
+      symbols[next_entry[huffman_code_lengths[symbol]]++] = symbol;
+    }
+  }
+};
+
+using ResultType = HeaderDecoder::ResultType;
+
+// rfc7541 5.1
+ResultType ReadInteger(const uint8_t* data, size_t data_size, size_t& offset,
+                       uint8_t prefix_bits, uint32_t& value) {
+  if (offset >= data_size) {
+    return ResultType::bad;
+  }
+  uint8_t prefix_max = (1 << prefix_bits) - 1;
+  value = data[offset++] & prefix_max;
+  if (value < prefix_max) {
+    return ResultType::good;
+  }
+  for (uint8_t shift = 0; offset < data_size; shift += 7) {
+    // larger values are never legitimate in a DNS answer
+    if (shift > 21) {
+      return ResultType::bad;
+    }
+    auto byte = data[offset++];
+    value += uint32_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return ResultType::good;
+    }
+  }
+  return ResultType::bad;
+}
+
+// rfc7541 5.2
+ResultType ReadString(const uint8_t* data, size_t data_size, size_t& offset,
+                      std::string& value) {
+  if (offset >= data_size) {
+    return ResultType::bad;
+  }
+  auto huffman = data[offset] & 0x80;
+  uint32_t length;
+  if (ReadInteger(data, data_size, offset, 7, length) != ResultType::good ||
+      length > data_size - offset) {
+    return ResultType::bad;
+  }
+  auto string_data = data + offset;
+  offset += length;
+  if (huffman) {
+    return HeaderDecoder::HuffmanDecode(string_data, length, value);
+  }
+  value.assign(reinterpret_cast<const char*>(string_data), length);
+  return ResultType::good;
+}
+
+void AppendInteger(std::string& block, uint8_t first_byte, uint8_t prefix_bits,
+                   uint32_t value) {
+  uint8_t prefix_max = (1 << prefix_bits) - 1;
+  if (value < prefix_max) {
+    block.push_back(first_byte | value);
+    return;
+  }
+  block.push_back(first_byte | prefix_max);
+  value -= prefix_max;
+  while (value >= 0x80) {
+    block.push_back(0x80 | (value & 0x7f));
+    value >>= 7;
+  }
+  block.push_back(value);
+}
+
+}  // namespace
+
+FrameHeader FrameHeader::Read(const uint8_t* data) {
+  FrameHeader header;
+  header.length =
+      (uint32_t(data[0]) << 16) | (uint32_t(data[1]) << 8) | data[2];
+  header.type = data[3];
+  header.flags = data[4];
+  uint32_t stream_id;
+  memcpy(&stream_id, data + 5, sizeof(stream_id));
+  // the reserved bit is ignored on receipt
+  header.stream_id = endian::big_to_native(stream_id) & max_stream_id;
+  return header;
+}
+
+void FrameEncoder::AppendFrameHeader(std::vector<uint8_t>& buffer,
+                                     uint32_t length, uint8_t type,
+                                     uint8_t flags, uint32_t stream_id) {
+  uint8_t header[FrameHeader::size] = {
+      uint8_t(length >> 16),
+      uint8_t(length >> 8),
+      uint8_t(length),
+      type,
+      flags,
+      uint8_t(stream_id >> 24),
+      uint8_t(stream_id >> 16),
+      uint8_t(stream_id >> 8),
+      uint8_t(stream_id),
+  };
+  buffer.insert(buffer.end(), std::begin(header), std::end(header));
+}
+
+void FrameEncoder::AppendSettings(
+    std::vector<uint8_t>& buffer,
+    std::initializer_list<std::pair<uint16_t, uint32_t>> settings) {
+  AppendFrameHeader(buffer, settings.size() * 6, FrameType::SETTINGS, 0, 0);
+  for (auto& [id, value] : settings) {
+    uint8_t setting[6] = {
+        uint8_t(id >> 8),     uint8_t(id),         uint8_t(value >> 24),
+        uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value),
+    };
+    buffer.insert(buffer.end(), std::begin(setting), std::end(setting));
+  }
+}
+
+void FrameEncoder::AppendSettingsAck(std::vector<uint8_t>& buffer) {
+  AppendFrameHeader(buffer, 0, FrameType::SETTINGS, FrameFlag::ACK, 0);
+}
+
+void FrameEncoder::AppendRstStream(std::vector<uint8_t>& buffer,
+                                   uint32_t stream_id, uint32_t error_code) {
+  AppendFrameHeader(buffer, sizeof(error_code), FrameType::RST_STREAM, 0,
+                    stream_id);
+  error_code = endian::native_to_big(error_code);
+  auto data = reinterpret_cast<const uint8_t*>(&error_code);
+  buffer.insert(buffer.end(), data, data + sizeof(error_code));
+}
+
+void FrameEncoder::AppendWindowUpdate(std::vector<uint8_t>& buffer,
+                                      uint32_t stream_id, uint32_t increment) {
+  AppendFrameHeader(buffer, sizeof(increment), FrameType::WINDOW_UPDATE, 0,
+                    stream_id);
+  increment = endian::native_to_big(increment);
+  auto data = reinterpret_cast<const uint8_t*>(&increment);
+  buffer.insert(buffer.end(), data, data + sizeof(increment));
+}
+
+void FrameEncoder::AppendPing(std::vector<uint8_t>& buffer, uint8_t flags,
+                              const uint8_t* opaque_data) {
+  AppendFrameHeader(buffer, 8, FrameType::PING, flags, 0);
+  buffer.insert(buffer.end(), opaque_data, opaque_data + 8);
+}
+
+void FrameEncoder::AppendGoaway(std::vector<uint8_t>& buffer,
+                                uint32_t last_stream_id, uint32_t error_code) {
+  AppendFrameHeader(buffer, 8, FrameType::GOAWAY, 0, 0);
+  uint32_t payload[2] = {endian::native_to_big(last_stream_id),
+                         endian::native_to_big(error_code)};
+  auto data = reinterpret_cast<const uint8_t*>(payload);
+  buffer.insert(buffer.end(), data, data + sizeof(payload));
+}
+
+void HeaderEncoder::AppendIndexed(std::string& block, uint8_t index) {
+  AppendInteger(block, 0x80, 7, index);
+}
+
+void HeaderEncoder::AppendLiteral(std::string& block, uint8_t name_index,
+                                  std::string_view value) {
+  AppendInteger(block, 0x00, 4, name_index);
+  AppendInteger(block, 0x00, 7, value.size());
+  block.append(value);
+}
+
+ResultType HeaderDecoder::Decode(const uint8_t* block, size_t block_size,
+                                 std::vector<Header>& headers) {
+  headers.clear();
+  size_t offset = 0;
+  while (offset < block_size) {
+    auto first_byte = block[offset];
+    uint32_t index;
+    if (first_byte & 0x80) {
+      // rfc7541 6.1: indexed header field
+      Header header;
+      if (ReadInteger(block, block_size, offset, 7, index) !=
+              ResultType::good ||
+          !Lookup(index, header)) {
+        return ResultType::bad;
+      }
+      headers.emplace_back(std::move(header));
+      continue;
+    }
+    if ((first_byte & 0xe0) == 0x20) {
+      // rfc7541 6.3: dynamic table size update
+      uint32_t size;
+      if (ReadInteger(block, block_size, offset, 5, size) !=
+              ResultType::good ||
+          size > table_size_limit_) {
+        return ResultType::bad;
+      }
+      max_dynamic_table_size_ = size;
+      Evict(max_dynamic_table_size_);
+      continue;
+    }
+    // rfc7541 6.2: literal header field, added to the dynamic table with
+    // incremental indexing, left out without indexing or never indexed
+    auto indexing = (first_byte & 0xc0) == 0x40;
+    Header header;
+    if (ReadInteger(block, block_size, offset, indexing ? 6 : 4, index) !=
+        ResultType::good) {
+      return ResultType::bad;
+    }
+    if (index) {
+      if (!Lookup(index, header)) {
+        return ResultType::bad;
+      }
+    } else if (ReadString(block, block_size, offset, header.first) !=
+               ResultType::good) {
+      return ResultType::bad;
+    }
+    if (ReadString(block, block_size, offset, header.second) !=
+        ResultType::good) {
+      return ResultType::bad;
+    }
+    if (indexing) {
+      Insert(header);
+    }
+    headers.emplace_back(std::move(header));
+  }
+  return ResultType::good;
+}
+
+void HeaderDecoder::reset() {
+  dynamic_table_.clear();
+  dynamic_table_size_ = 0;
+  max_dynamic_table_size_ = table_size_limit_;
+}
+
+bool HeaderDecoder::Lookup(uint32_t index, Header& header) const {
+  if (index == 0) {
+    return false;
+  }
+  if (index <= static_table.size()) {
+    auto& entry = static_table[index - 1];
+    header.first = entry.first;
+    header.second = entry.second;
+    return true;
+  }
+  index -= static_table.size() + 1;
+  if (index >= dynamic_table_.size()) {
+    return false;
+  }
+  header = dynamic_table_[index];
+  return true;
+}
+
+void HeaderDecoder::Insert(Header header) {
+  auto entry_size =
+      header.first.size() + header.second.size() + entry_overhead_;
+  // rfc7541 4.4: an entry larger than the table empties it
+  if (entry_size > max_dynamic_table_size_) {
+    Evict(0);
+    return;
+  }
+  Evict(max_dynamic_table_size_ - entry_size);
+  dynamic_table_.emplace_front(std::move(header));
+  dynamic_table_size_ += entry_size;
+}
+
+void HeaderDecoder::Evict(size_t size_limit) {
+  while (dynamic_table_size_ > size_limit) {
+    auto& entry = dynamic_table_.back();
+    dynamic_table_size_ -=
+        entry.first.size() + entry.second.size() + entry_overhead_;
+    dynamic_table_.pop_back();
+  }
+}
+
+ResultType HeaderDecoder::HuffmanDecode(const uint8_t* data, size_t data_size,
+                                        std::string& decoded) {
+  static const HuffmanTable table;
+  decoded.clear();
+  uint32_t code = 0;
+  size_t length = 0;
+  for (size_t i = 0; i < data_size; i++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      code = (code << 1) | ((data[i] >> bit) & 1);
+      length++;
+      if (length > huffman_max_code_length) {
+        return ResultType::bad;
+      }
+      if (code - table.first_code[length] < table.count[length]) {
+        auto symbol =
+            table.symbols[table.first_entry[length] + code -
+                          table.first_code[length]];
+        // rfc7541 5.2: EOS in a string is an error
+        if (symbol == huffman_eos) {
+          return ResultType::bad;
+        }
+        decoded.push_back(static_cast<char>(symbol));
+        code = 0;
+        length = 0;
+      }
+    }
+  }
+  // padding is the most significant bits of EOS, all ones and shorter than
+  // a byte
+  if (length > 7 || code != (1u << length) - 1) {
+    return ResultType::bad;
+  }
+  return ResultType::good;
+}
+
+}  // namespace http2
+}  // namespace dnstoy
@@ -0,0 +1,158 @@
+#ifndef DNSTOY_HTTP2_H_
+#define DNSTOY_HTTP2_H_
+
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace dnstoy {
+namespace http2 {
+
+// The client side of HTTP/2 (rfc7540) needed by DNS over HTTPS: frames are
+// built into and parsed from plain buffers, the connection state is left to
+// the resolver.
+
+// rfc7540 3.5
+constexpr std::string_view connection_preface =
+    "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// rfc7540 4.1
+struct FrameHeader {
+  static constexpr size_t size = 9;
+  uint32_t length;
+  uint8_t type;
+  uint8_t flags;
+  uint32_t stream_id;
+
+  // data must hold size bytes
+  static FrameHeader Read(const uint8_t* data);
+};
+
+// rfc7540 6
+struct FrameType {
+  static constexpr uint8_t DATA = 0x0;
+  static constexpr uint8_t HEADERS = 0x1;
+  static constexpr uint8_t PRIORITY = 0x2;
+  static constexpr uint8_t RST_STREAM = 0x3;
+  static constexpr uint8_t SETTINGS = 0x4;
+  static constexpr uint8_t PUSH_PROMISE = 0x5;
+  static constexpr uint8_t PING = 0x6;
+  static constexpr uint8_t GOAWAY = 0x7;
+  static constexpr uint8_t WINDOW_UPDATE = 0x8;
+  static constexpr uint8_t CONTINUATION = 0x9;
+};
+
+struct FrameFlag {
+  static constexpr uint8_t END_STREAM = 0x1;
+  static constexpr uint8_t ACK = 0x1;
+  static constexpr uint8_t END_HEADERS = 0x4;
+  static constexpr uint8_t PADDED = 0x8;
+  static constexpr uint8_t PRIORITY = 0x20;
+};
+
+// rfc7540 6.5.2
+struct Setting {
+  static constexpr uint16_t HEADER_TABLE_SIZE = 0x1;
+  static constexpr uint16_t ENABLE_PUSH = 0x2;
+  static constexpr uint16_t MAX_CONCURRENT_STREAMS = 0x3;
+  static constexpr uint16_t INITIAL_WINDOW_SIZE = 0x4;
+  static constexpr uint16_t MAX_FRAME_SIZE = 0x5;
+  static constexpr uint16_t MAX_HEADER_LIST_SIZE = 0x6;
+};
+
+// rfc7540 7
+struct ErrorCode {
+  static constexpr uint32_t NO_ERROR = 0x0;
+  static constexpr uint32_t PROTOCOL_ERROR = 0x1;
+  static constexpr uint32_t REFUSED_STREAM = 0x7;
+  static constexpr uint32_t CANCEL = 0x8;
+};
+
+// rfc7540 6.5.2 and 6.9.2: values every connection starts with
+constexpr uint32_t default_window_size = 65535;
+constexpr uint32_t default_max_frame_size = 16384;
+constexpr uint32_t max_stream_id = 0x7fffffff;
+
+class FrameEncoder {
+ public:
+  static void AppendFrameHeader(std::vector<uint8_t>& buffer, uint32_t length,
+                                uint8_t type, uint8_t flags,
+                                uint32_t stream_id);
+  static void AppendSettings(
+      std::vector<uint8_t>& buffer,
+      std::initializer_list<std::pair<uint16_t, uint32_t>> settings);
+  static void AppendSettingsAck(std::vector<uint8_t>& buffer);
+  static void AppendRstStream(std::vector<uint8_t>& buffer, uint32_t stream_id,
+                              uint32_t error_code);
+  static void AppendWindowUpdate(std::vector<uint8_t>& buffer,
+                                 uint32_t stream_id, uint32_t increment);
+  // opaque_data: the 8 bytes of payload, echoed by the ack
+  static void AppendPing(std::vector<uint8_t>& buffer, uint8_t flags,
+                         const uint8_t* opaque_data);
+  static void AppendGoaway(std::vector<uint8_t>& buffer,
+                           uint32_t last_stream_id, uint32_t error_code);
+};
+
+// HPACK (rfc7541) representations of request headers. Strings are never
+// Huffman encoded and headers are never added to the dynamic table of the
+// server, so the encoder keeps no state.
+class HeaderEncoder {
+ public:
+  // index: of the static table, rfc7541 appendix A
+  static void AppendIndexed(std::string& block, uint8_t index);
+  // literal header field without indexing, name taken from the static table
+  static void AppendLiteral(std::string& block, uint8_t name_index,
+                            std::string_view value);
+
+  // static table indexes of the request headers
+  static constexpr uint8_t authority = 1;
+  static constexpr uint8_t method_post = 3;
+  static constexpr uint8_t path = 4;
+  static constexpr uint8_t scheme_https = 7;
+  static constexpr uint8_t accept = 19;
+  static constexpr uint8_t content_length = 28;
+  static constexpr uint8_t content_type = 31;
+};
+
+// HPACK decoder of the header blocks of one connection, which share the
+// dynamic table built by the server.
+// thread-unsafe, designed for thread_local use
+class HeaderDecoder {
+ public:
+  using Header = std::pair<std::string, std::string>;
+  enum class ResultType { good, bad };
+
+  // block: a complete header block, with CONTINUATION frames joined.
+  // Every block of the connection must be decoded in order, even the ones
+  // of unknown streams. Returns bad on a compression error, which is fatal
+  // to the connection.
+  ResultType Decode(const uint8_t* block, size_t block_size,
+                    std::vector<Header>& headers);
+  // a new connection starts with an empty dynamic table
+  void reset();
+
+  static ResultType HuffmanDecode(const uint8_t* data, size_t data_size,
+                                  std::string& decoded);
+
+ private:
+  // SETTINGS_HEADER_TABLE_SIZE is left at its default
+  static constexpr size_t table_size_limit_ = 4096;
+  // rfc7541 4.1: overhead of every entry
+  static constexpr size_t entry_overhead_ = 32;
+  // newest first, so index 62 is the front
+  std::deque<Header> dynamic_table_;
+  size_t dynamic_table_size_ = 0;
+  size_t max_dynamic_table_size_ = table_size_limit_;
+
+  bool Lookup(uint32_t index, Header& header) const;
+  void Insert(Header header);
+  void Evict(size_t size_limit);
+};
+
+}  // namespace http2
+}  // namespace dnstoy
+#endif  // DNSTOY_HTTP2_H_
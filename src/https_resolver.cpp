@@ -0,0 +1,842 @@
+#include "https_resolver.hpp"
+
+#include <algorithm>
+#include <boost/endian/conversion.hpp>
+#include <cstring>
+#include <limits>
+
+#include "configuration.hpp"
+#include "dns.hpp"
+#include "engine.hpp"
+#include "logging.hpp"
+#include "tls_session_store.hpp"
+
+namespace ssl = boost::asio::ssl;
+namespace endian = boost::endian;
+using boost::asio::async_write;
+using boost::asio::ip::tcp;
+using boost::system::error_code;
+using dnstoy::http2::FrameEncoder;
+using dnstoy::http2::FrameFlag;
+using dnstoy::http2::FrameHeader;
+using dnstoy::http2::FrameType;
+using dnstoy::http2::HeaderEncoder;
+using std::chrono::milliseconds;
+using std::string;
+using std::chrono::seconds;
+
+namespace dnstoy {
+
+namespace {
+
+// the app data of SSL is taken by the verify callback of asio
+int ResolverExDataIndex() {
+  static int index =
+      SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+  return index;
+}
+
+// rfc7540 3.3: HTTP/2 is negotiated by ALPN, the list is length prefixed
+const uint8_t alpn_protocols[] = {2, 'h', '2'};
+
+uint32_t ReadUint32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return endian::big_to_native(value);
+}
+
+constexpr auto tcp_length_size = offsetof(dns::RawTcpMessage, message);
+
+}  // namespace
+
+HttpsResolver::HttpsResolver(const std::string& hostname,
+                             const std::string& path,
+                             const tcp_endpoints_type& endpoints)
+    : ssl_context_(ssl::context::tls_client),
+      session_key_(hostname),
+      hostname_(hostname),
+      endpoints_(endpoints),
+      endpoint_rtts_(endpoints.size(), ParallelConnector::unmeasured_rtt),
+      keep_warm_interval_(
+          Configuration::get("keep-warm-interval").as<uint32_t>()),
+      timeout_timer_(Engine::get().GetExecutor()) {
+  static const auto ca_file = Configuration::get("tls-ca-file").as<string>();
+  if (ca_file.empty()) {
+    ssl_context_.set_default_verify_paths();
+  } else {
+    // checked by Resolver::init
+    error_code error;
+    ssl_context_.load_verify_file(ca_file, error);
+  }
+  // rfc7540 9.2: TLS 1.2 or later
+  ssl_context_.set_options(ssl::context::default_workarounds |
+                           ssl::context::no_tlsv1 | ssl::context::no_tlsv1_1);
+  SSL_CTX_set_alpn_protos(ssl_context_.native_handle(), alpn_protocols,
+                          sizeof(alpn_protocols));
+  SSL_CTX_set_session_cache_mode(
+      ssl_context_.native_handle(),
+      SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ssl_context_.native_handle(), StoreNewSession);
+  if (!endpoints_.empty()) {
+    session_key_ += "/" + endpoints_.front().address().to_string();
+  }
+  // kept apart from the sessions of dns-over-tls to the same server
+  session_key_ += "/h2";
+
+  // rfc8484 4.1: POST with the DNS message as body
+  HeaderEncoder::AppendIndexed(request_headers_, HeaderEncoder::method_post);
+  HeaderEncoder::AppendIndexed(request_headers_, HeaderEncoder::scheme_https);
+  HeaderEncoder::AppendLiteral(request_headers_, HeaderEncoder::path, path);
+  HeaderEncoder::AppendLiteral(request_headers_, HeaderEncoder::authority,
+                               hostname_);
+  HeaderEncoder::AppendLiteral(request_headers_, HeaderEncoder::content_type,
+                               media_type_);
+  HeaderEncoder::AppendLiteral(request_headers_, HeaderEncoder::accept,
+                               media_type_);
+}
+
+void HttpsResolver::Resolve(QueryContext::pointer& query,
+                            QueryResultHandler& handler) {
+  query_manager_.QueueQuery(query, handler);
+  if (io_status_ < IOStatus::READY) {
+    Connect();
+  } else {
+    DoWrite();
+  }
+}
+
+void HttpsResolver::set_keep_warm(bool keep_warm) {
+  if (keep_warm_ == keep_warm) {
+    return;
+  }
+  keep_warm_ = keep_warm;
+  LOG_DEBUG(<< hostname_ << " keep warm " << keep_warm);
+  if (io_status_ >= IOStatus::READY) {
+    UpdateSocketTimeout(IdleTimeout());
+  } else if (keep_warm_) {
+    Connect();
+  }
+}
+
+void HttpsResolver::Close() {
+  timeout_timer_.cancel();
+  CloseConnection();
+}
+
+milliseconds HttpsResolver::IdleTimeout() const {
+  if (!streams_.empty() || ping_pending_) {
+    return response_timeout_;
+  }
+  if (keep_warm_) {
+    return keep_warm_interval_;
+  }
+  return idle_timeout_;
+}
+
+void HttpsResolver::UpdateSocketTimeout(milliseconds duration) {
+  timeout_timer_.expires_after(duration);
+  timeout_timer_.async_wait([this](boost::system::error_code error) {
+    if (error) {
+      return;
+    }
+    if (keep_warm_ && io_status_ >= IOStatus::READY && streams_.empty() &&
+        !ping_pending_) {
+      // rfc7540 6.7: the ack proves the connection still works
+      LOG_TRACE(<< hostname_ << " keep warm ping");
+      static const uint8_t opaque_data[8] = {};
+      FrameEncoder::AppendPing(control_frames_, 0, opaque_data);
+      ping_pending_ = true;
+      UpdateSocketTimeout(IdleTimeout());
+      DoWrite();
+      return;
+    }
+    LOG_DEBUG(<< hostname_ << " socket timed out");
+    if (streams_.empty() && !ping_pending_ && !query_manager_.QueueSize()) {
+      CloseConnection();
+    } else {
+      Reconnect();
+    }
+  });
+}
+
+void HttpsResolver::CloseConnection() {
+  LOG_TRACE(<< hostname_);
+  io_status_ = IOStatus::NOT_INITIALIZED;
+  if (connector_) {
+    connector_->Cancel();
+    connector_.reset();
+  }
+  if (!socket_) {
+    return;
+  }
+  error_code error;
+  socket_->lowest_layer().cancel(error);
+  socket_->lowest_layer().close(error);
+  socket_.reset();
+}
+
+void HttpsResolver::Reconnect() {
+  if (io_status_ == IOStatus::NOT_INITIALIZED) {
+    Connect();
+    return;
+  }
+  if (io_status_ == IOStatus::INITIALIZATION_DELAYED_FOR_RETRY) {
+    return;
+  }
+  CloseConnection();
+  if (retry_connect_counter_ == 0) {
+    retry_connect_counter_++;
+    Connect();
+    return;
+  }
+  io_status_ = IOStatus::INITIALIZATION_DELAYED_FOR_RETRY;
+  auto wait_time =
+      std::min(first_retry_interval_ * (1 << retry_connect_counter_),
+               max_retry_interval_);
+  retry_connect_counter_++;
+  timeout_timer_.expires_after(wait_time);
+  timeout_timer_.async_wait([this](boost::system::error_code error) {
+    if (error) {
+      return;
+    }
+    io_status_ = IOStatus::NOT_INITIALIZED;
+    Connect();
+  });
+}
+
+void HttpsResolver::Connect() {
+  if (io_status_ != IOStatus::NOT_INITIALIZED) {
+    return;
+  }
+  io_status_ = IOStatus::INITIALIZING;
+  socket_ =
+      std::make_shared<stream_type>(Engine::get().GetExecutor(), ssl_context_);
+  LOG_INFO(<< hostname_);
+
+  RequeueStreams();
+  next_stream_id_ = 1;
+  max_concurrent_streams_ = stream_limit_;
+  send_window_ = http2::default_window_size;
+  peer_initial_window_size_ = http2::default_window_size;
+  peer_max_frame_size_ = http2::default_max_frame_size;
+  receive_window_consumed_ = 0;
+  going_away_ = false;
+  ping_pending_ = false;
+  header_decoder_.reset();
+  header_block_continues_ = false;
+  control_frames_.clear();
+  read_size_ = 0;
+
+  auto ssl = socket_->native_handle();
+  socket_->set_verify_mode(ssl::verify_peer);
+  SSL_set_ex_data(ssl, ResolverExDataIndex(), this);
+  // servers behind a CDN pick the certificate by SNI
+  SSL_set_tlsext_host_name(ssl, hostname_.c_str());
+  auto param = SSL_get0_param(ssl);
+  X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+  X509_VERIFY_PARAM_set1_host(param, hostname_.data(), hostname_.length());
+
+  UpdateSocketTimeout(seconds(10));
+
+  auto handler = [this, for_stream = socket_](
+                     const boost::system::error_code& error,
+                     tcp::socket&& socket, size_t endpoint_index,
+                     std::chrono::microseconds rtt) {
+    for (auto failed : connector_->failed_endpoints()) {
+      endpoint_rtts_[failed] = ParallelConnector::failed_rtt;
+    }
+    connector_.reset();
+    if (error) {
+      LOG_ERROR(<< hostname_ << " connect failed: " << error.message());
+      Reconnect();
+      return;
+    }
+    ParallelConnector::RecordRtt(endpoint_rtts_[endpoint_index], rtt);
+    LOG_DEBUG(<< hostname_ << " connected to " << endpoints_[endpoint_index]
+              << " in " << rtt.count() << "us");
+    for_stream->next_layer() = std::move(socket);
+    Handshake();
+  };
+
+  connector_ = ParallelConnector::create(Engine::get().GetExecutor());
+  connector_->Start(
+      endpoints_,
+      ParallelConnector::PreferredOrder(endpoints_, endpoint_rtts_),
+      std::move(handler));
+}
+
+void HttpsResolver::Handshake() {
+  // taken once connected, a failed connect wastes no ticket
+  auto session = TlsSessionStore::get().Get(session_key_);
+  if (session) {
+    SSL_set_session(socket_->native_handle(), session);
+    SSL_SESSION_free(session);
+  }
+  socket_->async_handshake(
+      ssl::stream_base::client,
+      [this, for_stream = socket_](const boost::system::error_code& error) {
+        if (!for_stream->lowest_layer().is_open()) {
+          return;
+        }
+        if (error) {
+          LOG_ERROR(<< hostname_ << " handshake failed: " << error.message());
+          Reconnect();
+          return;
+        }
+        const unsigned char* protocol;
+        unsigned int protocol_length;
+        SSL_get0_alpn_selected(socket_->native_handle(), &protocol,
+                               &protocol_length);
+        if (protocol_length != 2 || memcmp(protocol, "h2", 2) != 0) {
+          LOG_ERROR(<< hostname_ << " does not support HTTP/2");
+          Reconnect();
+          return;
+        }
+        LOG_TRACE(<< hostname_ << " handshake success"
+                  << (SSL_session_reused(socket_->native_handle())
+                          ? ", session resumed"
+                          : ""));
+        HandleReady();
+      });
+}
+
+void HttpsResolver::HandleReady() {
+  io_status_ = IOStatus::READY;
+  retry_connect_counter_ = 0;
+  // rfc7540 3.5: requests may follow the preface and SETTINGS right away,
+  // without waiting for the SETTINGS of the server
+  control_frames_.insert(control_frames_.begin(),
+                         http2::connection_preface.begin(),
+                         http2::connection_preface.end());
+  FrameEncoder::AppendSettings(
+      control_frames_,
+      {{http2::Setting::ENABLE_PUSH, 0},
+       {http2::Setting::INITIAL_WINDOW_SIZE, stream_window_size_}});
+  FrameEncoder::AppendWindowUpdate(
+      control_frames_, 0,
+      connection_window_size_ - http2::default_window_size);
+  // room for a few frames, larger ones than default_max_frame_size are
+  // refused
+  read_buffer_.resize(4 * (FrameHeader::size + http2::default_max_frame_size));
+  UpdateSocketTimeout(IdleTimeout());
+  DoWrite();
+  DoRead();
+}
+
+void HttpsResolver::DoWrite() {
+  if (io_status_ == IOStatus::WRITING) {
+    return;
+  }
+  if (io_status_ != IOStatus::READY) {
+    Reconnect();
+    return;
+  }
+  io_status_ = IOStatus::WRITING;
+  write_buffer_.clear();
+  write_buffer_.swap(control_frames_);
+  auto stream_count = OpenStreams();
+  if (write_buffer_.empty()) {
+    io_status_ = IOStatus::READY;
+    return;
+  }
+  if (stream_count) {
+    LOG_TRACE(<< hostname_ << " write " << stream_count << " streams");
+    UpdateSocketTimeout(IdleTimeout());
+  }
+  auto handler = [this, for_stream = socket_](
+                     const boost::system::error_code& error,
+                     std::size_t /*bytes_transfered*/) {
+    if (!for_stream->lowest_layer().is_open()) {
+      return;
+    }
+    if (error) {
+      if (error != boost::asio::error::operation_aborted) {
+        LOG_ERROR(<< hostname_ << " write failed " << error.message());
+      }
+      Reconnect();
+      return;
+    }
+    io_status_ = IOStatus::READY;
+    DoWrite();
+  };
+  async_write(*socket_, boost::asio::buffer(write_buffer_),
+              std::move(handler));
+}
+
+size_t HttpsResolver::OpenStreams() {
+  size_t stream_count = 0;
+  QueryManager::QueryRecord record;
+  if (!max_concurrent_streams_ && query_manager_.QueueSize()) {
+    // rfc7540 6.5.2: no stream is taken until the server sends other
+    // SETTINGS, queries fail now instead of at their timeout
+    LOG_ERROR(<< hostname_ << " takes no streams, "
+              << query_manager_.QueueSize() << " queries failed");
+    while (query_manager_.GetRecord(record)) {
+      DropQuery(record);
+    }
+    return 0;
+  }
+  while (!going_away_ && streams_.size() < max_concurrent_streams_ &&
+         write_buffer_.size() < write_size_limit_ &&
+         query_manager_.GetRecord(record)) {
+    auto& context = *record.first;
+    if (context.status != QueryContext::Status::WAITING_FOR_ANSWER ||
+        context.raw_message.size() <= tcp_length_size) {
+      DropQuery(record);
+      continue;
+    }
+    // every body is sent at once, within the windows of the connection and
+    // of a new stream
+    int64_t body_size = context.raw_message.size() - tcp_length_size;
+    if (body_size > peer_initial_window_size_) {
+      LOG_ERROR(<< hostname_ << " query larger than stream window");
+      DropQuery(record);
+      continue;
+    }
+    if (body_size > send_window_) {
+      query_manager_.CutInQueryRecord(std::move(record));
+      break;
+    }
+    auto stream_id = next_stream_id_;
+    next_stream_id_ += 2;
+    if (next_stream_id_ > http2::max_stream_id) {
+      going_away_ = true;
+    }
+    LOG_TRACE(<< hostname_ << " query "
+              << (context.query.questions.size()
+                      ? context.query.questions[0].name
+                      : "")
+              << " stream " << stream_id);
+
+    auto header_block = request_headers_;
+    HeaderEncoder::AppendLiteral(header_block, HeaderEncoder::content_length,
+                                 std::to_string(body_size));
+    FrameEncoder::AppendFrameHeader(write_buffer_, header_block.size(),
+                                    FrameType::HEADERS, FrameFlag::END_HEADERS,
+                                    stream_id);
+    write_buffer_.insert(write_buffer_.end(), header_block.begin(),
+                         header_block.end());
+    auto body = context.raw_message.data() + tcp_length_size;
+    for (int64_t offset = 0; offset < body_size;) {
+      auto frame_size =
+          std::min<int64_t>(body_size - offset, peer_max_frame_size_);
+      offset += frame_size;
+      FrameEncoder::AppendFrameHeader(
+          write_buffer_, frame_size, FrameType::DATA,
+          offset == body_size ? FrameFlag::END_STREAM : 0, stream_id);
+      auto data_offset = write_buffer_.size();
+      write_buffer_.insert(write_buffer_.end(), body + offset - frame_size,
+                           body + offset);
+      if (offset == frame_size) {
+        // rfc8484 4.1: ID 0 keeps answers cacheable by HTTP caches
+        write_buffer_[data_offset] = 0;
+        write_buffer_[data_offset + 1] = 0;
+      }
+    }
+    send_window_ -= body_size;
+
+    auto& stream = streams_[stream_id];
+    stream.record = std::move(record);
+    stream.status.clear();
+    stream.answer.assign(tcp_length_size, 0);
+    stream_count++;
+  }
+  return stream_count;
+}
+
+void HttpsResolver::DoRead() {
+  socket_->async_read_some(
+      boost::asio::buffer(read_buffer_.data() + read_size_,
+                          read_buffer_.size() - read_size_),
+      [this, for_stream = socket_](const boost::system::error_code& error,
+                                   std::size_t size) {
+        if (!for_stream->lowest_layer().is_open()) {
+          return;
+        }
+        if (error) {
+          if (error == boost::asio::error::operation_aborted) {
+            return;
+          }
+          if (error == boost::asio::error::eof ||
+              error == ssl::error::stream_truncated) {
+            LOG_DEBUG(<< hostname_ << " connection closed by peer");
+          } else {
+            LOG_ERROR(<< hostname_ << " " << error.message());
+          }
+          // open streams are never answered on this connection
+          if (keep_warm_ || !streams_.empty() || query_manager_.QueueSize()) {
+            Reconnect();
+          } else {
+            CloseConnection();
+          }
+          return;
+        }
+        read_size_ += size;
+        size_t offset = 0;
+        while (read_size_ - offset >= FrameHeader::size) {
+          auto header = FrameHeader::Read(read_buffer_.data() + offset);
+          // SETTINGS_MAX_FRAME_SIZE is left at its default
+          if (header.length > http2::default_max_frame_size) {
+            LOG_ERROR(<< hostname_ << " frame of " << header.length
+                      << " bytes refused");
+            Reconnect();
+            return;
+          }
+          if (read_size_ - offset < FrameHeader::size + header.length) {
+            break;
+          }
+          if (!HandleFrame(header,
+                           read_buffer_.data() + offset + FrameHeader::size)) {
+            Reconnect();
+            return;
+          }
+          if (socket_ != for_stream) {
+            // the connection is done with, after its last stream
+            return;
+          }
+          offset += FrameHeader::size + header.length;
+        }
+        read_size_ -= offset;
+        memmove(read_buffer_.data(), read_buffer_.data() + offset, read_size_);
+        if (receive_window_consumed_ >= connection_window_size_ / 2) {
+          FrameEncoder::AppendWindowUpdate(control_frames_, 0,
+                                           receive_window_consumed_);
+          receive_window_consumed_ = 0;
+        }
+        if (io_status_ == IOStatus::READY &&
+            (!control_frames_.empty() || query_manager_.QueueSize())) {
+          DoWrite();
+        }
+        DoRead();
+      });
+}
+
+bool HttpsResolver::HandleFrame(const FrameHeader& header,
+                                const uint8_t* payload) {
+  auto length = header.length;
+  // rfc7540 6.10: nothing comes between a header block and its CONTINUATION
+  // frames
+  if (header_block_continues_ &&
+      (header.type != FrameType::CONTINUATION ||
+       header.stream_id != header_block_stream_id_)) {
+    LOG_ERROR(<< hostname_ << " header block interrupted");
+    return false;
+  }
+  switch (header.type) {
+    case FrameType::DATA: {
+      // rfc7540 6.1
+      if (!header.stream_id) {
+        return false;
+      }
+      receive_window_consumed_ += length;
+      if (header.flags & FrameFlag::PADDED) {
+        if (!length || payload[0] >= length) {
+          return false;
+        }
+        length -= 1 + payload[0];
+        payload++;
+      }
+      // data of streams already reset only counts for flow control
+      auto stream = streams_.find(header.stream_id);
+      if (stream == streams_.end()) {
+        return true;
+      }
+      auto& answer = stream->second.answer;
+      if (answer.size() + length >
+          tcp_length_size + std::numeric_limits<uint16_t>::max()) {
+        LOG_ERROR(<< hostname_ << " answer of stream " << header.stream_id
+                  << " too large");
+        // rfc7540 8.1: the rest of the response is not wanted
+        FrameEncoder::AppendRstStream(control_frames_, header.stream_id,
+                                      http2::ErrorCode::CANCEL);
+        stream->second.status.clear();
+        FinishStream(header.stream_id);
+        return true;
+      }
+      answer.insert(answer.end(), payload, payload + length);
+      if (header.flags & FrameFlag::END_STREAM) {
+        FinishStream(header.stream_id);
+      }
+      return true;
+    }
+    case FrameType::HEADERS: {
+      // rfc7540 6.2, CONTINUATION frames follow on the same stream
+      if (!header.stream_id) {
+        return false;
+      }
+      size_t skipped = 0;
+      size_t padding = 0;
+      if (header.flags & FrameFlag::PADDED) {
+        padding = length ? payload[0] : 0;
+        skipped++;
+      }
+      if (header.flags & FrameFlag::PRIORITY) {
+        // stream dependency and weight
+        skipped += 5;
+      }
+      if (skipped + padding > length) {
+        return false;
+      }
+      header_block_.assign(payload + skipped, payload + length - padding);
+      header_block_stream_id_ = header.stream_id;
+      header_block_ends_stream_ = header.flags & FrameFlag::END_STREAM;
+      header_block_continues_ = !(header.flags & FrameFlag::END_HEADERS);
+      return header_block_continues_ || HandleHeaderBlock();
+    }
+    case FrameType::CONTINUATION: {
+      if (!header_block_continues_) {
+        return false;
+      }
+      header_block_.insert(header_block_.end(), payload, payload + length);
+      if (header_block_.size() > header_block_size_limit_) {
+        LOG_ERROR(<< hostname_ << " header block too large");
+        return false;
+      }
+      header_block_continues_ = !(header.flags & FrameFlag::END_HEADERS);
+      return header_block_continues_ || HandleHeaderBlock();
+    }
+    case FrameType::RST_STREAM: {
+      // rfc7540 6.4
+      if (!header.stream_id || length != 4) {
+        return false;
+      }
+      auto error_code = ReadUint32(payload);
+      auto stream = streams_.find(header.stream_id);
+      if (stream == streams_.end()) {
+        return true;
+      }
+      LOG_DEBUG(<< hostname_ << " stream " << header.stream_id
+                << " reset, error " << error_code);
+      if (error_code == http2::ErrorCode::REFUSED_STREAM) {
+        // rfc7540 8.1.4: the request was not processed
+        RetryStream(header.stream_id);
+      } else {
+        stream->second.status.clear();
+        FinishStream(header.stream_id);
+      }
+      return true;
+    }
+    case FrameType::SETTINGS: {
+      if (header.stream_id || length % 6) {
+        return false;
+      }
+      if (!(header.flags & FrameFlag::ACK)) {
+        HandleSettings(payload, length);
+        FrameEncoder::AppendSettingsAck(control_frames_);
+      }
+      return true;
+    }
+    case FrameType::PUSH_PROMISE:
+      LOG_ERROR(<< hostname_ << " push refused by SETTINGS_ENABLE_PUSH");
+      return false;
+    case FrameType::PING: {
+      if (header.stream_id || length != 8) {
+        return false;
+      }
+      if (header.flags & FrameFlag::ACK) {
+        ping_pending_ = false;
+        UpdateSocketTimeout(IdleTimeout());
+      } else {
+        FrameEncoder::AppendPing(control_frames_, FrameFlag::ACK, payload);
+      }
+      return true;
+    }
+    case FrameType::GOAWAY: {
+      if (header.stream_id || length < 8) {
+        return false;
+      }
+      HandleGoaway(ReadUint32(payload) & http2::max_stream_id,
+                   ReadUint32(payload + 4));
+      return true;
+    }
+    case FrameType::WINDOW_UPDATE: {
+      if (length != 4) {
+        return false;
+      }
+      // stream windows are never waited for, a request fits in a new one
+      if (!header.stream_id) {
+        send_window_ += ReadUint32(payload) & 0x7fffffff;
+      }
+      return true;
+    }
+    default:
+      // rfc7540 4.1: PRIORITY and unknown frames are ignored
+      return true;
+  }
+}
+
+bool HttpsResolver::HandleHeaderBlock() {
+  // blocks of every stream update the dynamic table
+  if (header_decoder_.Decode(header_block_.data(), header_block_.size(),
+                             headers_) !=
+      http2::HeaderDecoder::ResultType::good) {
+    LOG_ERROR(<< hostname_ << " header block decode failed");
+    return false;
+  }
+  auto stream = streams_.find(header_block_stream_id_);
+  if (stream == streams_.end()) {
+    return true;
+  }
+  // trailers carry no :status, informational responses are followed by the
+  // final one
+  for (auto& [name, value] : headers_) {
+    if (name == ":status") {
+      stream->second.status = value;
+      break;
+    }
+  }
+  if (header_block_ends_stream_) {
+    FinishStream(header_block_stream_id_);
+  }
+  return true;
+}
+
+void HttpsResolver::HandleSettings(const uint8_t* payload, uint32_t length) {
+  for (uint32_t offset = 0; offset < length; offset += 6) {
+    uint16_t id = (payload[offset] << 8) | payload[offset + 1];
+    auto value = ReadUint32(payload + offset + 2);
+    switch (id) {
+      case http2::Setting::MAX_CONCURRENT_STREAMS:
+        max_concurrent_streams_ = std::min(value, stream_limit_);
+        break;
+      case http2::Setting::INITIAL_WINDOW_SIZE:
+        peer_initial_window_size_ = value;
+        break;
+      case http2::Setting::MAX_FRAME_SIZE:
+        peer_max_frame_size_ =
+            std::max(value, http2::default_max_frame_size);
+        break;
+      default:
+        // HEADER_TABLE_SIZE does not matter to an encoder never indexing
+        break;
+    }
+  }
+  LOG_DEBUG(<< hostname_ << " max concurrent streams "
+            << max_concurrent_streams_);
+}
+
+void HttpsResolver::HandleGoaway(uint32_t last_stream_id,
+                                 uint32_t error_code) {
+  LOG_INFO(<< hostname_ << " GOAWAY, last stream " << last_stream_id
+           << ", error " << error_code);
+  going_away_ = true;
+  // rfc7540 6.8: streams after the last one were never processed
+  std::vector<uint32_t> unprocessed;
+  for (auto& [stream_id, stream] : streams_) {
+    if (stream_id > last_stream_id) {
+      unprocessed.push_back(stream_id);
+    }
+  }
+  // retried in the order they were sent
+  std::sort(unprocessed.rbegin(), unprocessed.rend());
+  for (auto stream_id : unprocessed) {
+    RetryStream(stream_id);
+  }
+  if (streams_.empty()) {
+    CloseConnection();
+    if (query_manager_.QueueSize() || keep_warm_) {
+      Connect();
+    }
+  }
+}
+
+void HttpsResolver::FinishStream(uint32_t stream_id) {
+  auto i = streams_.find(stream_id);
+  auto stream = std::move(i->second);
+  streams_.erase(i);
+  auto& record = stream.record;
+  auto& context = record.first;
+  if (context->status != QueryContext::Status::WAITING_FOR_ANSWER) {
+    DropQuery(record);
+  } else if (stream.status != "200") {
+    LOG_ERROR(<< hostname_ << " stream " << stream_id << " failed, status "
+              << (stream.status.empty() ? "none" : stream.status));
+    DropQuery(record);
+  } else {
+    auto& answer = stream.answer;
+    auto message_length =
+        endian::native_to_big(uint16_t(answer.size() - tcp_length_size));
+    memcpy(answer.data(), &message_length, sizeof(message_length));
+    if (dns::MessageEncoder::RewriteIDToTcpMessage(
+            answer.data(), answer.size(), context->query.header.id) !=
+        dns::MessageEncoder::ResultType::good) {
+      LOG_ERROR(<< hostname_ << " stream " << stream_id << " bad answer");
+      DropQuery(record);
+    } else {
+      LOG_TRACE(<< hostname_ << " stream " << stream_id << " answered");
+      context->status = QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER;
+      context->raw_message.swap(answer);
+      record.second(std::move(context),
+                    boost::system::errc::make_error_code(
+                        boost::system::errc::success));
+    }
+  }
+  if (going_away_ && streams_.empty() && io_status_ >= IOStatus::READY) {
+    LOG_DEBUG(<< hostname_ << " connection drained");
+    CloseConnection();
+    if (query_manager_.QueueSize() || keep_warm_) {
+      Connect();
+    }
+    return;
+  }
+  UpdateSocketTimeout(IdleTimeout());
+}
+
+void HttpsResolver::RetryStream(uint32_t stream_id) {
+  auto i = streams_.find(stream_id);
+  auto record = std::move(i->second.record);
+  streams_.erase(i);
+  if (record.first->status == QueryContext::Status::WAITING_FOR_ANSWER) {
+    query_manager_.CutInQueryRecord(std::move(record));
+  } else {
+    DropQuery(record);
+  }
+}
+
+void HttpsResolver::RequeueStreams() {
+  // the oldest query ends up first in the queue
+  std::vector<uint32_t> stream_ids;
+  for (auto& [stream_id, stream] : streams_) {
+    stream_ids.push_back(stream_id);
+  }
+  std::sort(stream_ids.rbegin(), stream_ids.rend());
+  for (auto stream_id : stream_ids) {
+    RetryStream(stream_id);
+  }
+}
+
+int HttpsResolver::StoreNewSession(SSL* ssl, SSL_SESSION* session) {
+  auto resolver =
+      static_cast<HttpsResolver*>(SSL_get_ex_data(ssl, ResolverExDataIndex()));
+  LOG_TRACE(<< resolver->hostname_ << " new session");
+  TlsSessionStore::get().Put(resolver->session_key_, session);
+  // the store keeps its own copy
+  return 0;
+}
+
+void HttpsResolver::DropQuery(QueryManager::QueryRecord& record) {
+  error_code error;
+  switch (record.first->status) {
+    case QueryContext::Status::EXPIRED:
+      LOG_INFO(<< hostname_ << " " << record.first->query.header.id
+               << " timed out");
+      error = boost::asio::error::timed_out;
+      break;
+    case QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER:
+    case QueryContext::Status::ANSWER_ACCEPTED:
+      // already answered by another resolver
+      error = boost::system::errc::make_error_code(
+          boost::system::errc::operation_canceled);
+      break;
+    case QueryContext::Status::WAITING_FOR_ANSWER:
+      error = boost::system::errc::make_error_code(
+          boost::system::errc::bad_message);
+      break;
+    default:
+      LOG_ERROR();
+      assert(false);
+  }
+  record.second(std::move(record.first), error);
+}
+
+}  // namespace dnstoy
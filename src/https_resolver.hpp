@@ -0,0 +1,146 @@
+#ifndef DNSTOY_HTTPS_RESOLVER_H_
+#define DNSTOY_HTTPS_RESOLVER_H_
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "http2.hpp"
+#include "parallel_connector.hpp"
+#include "query.hpp"
+
+namespace dnstoy {
+
+// DNS over HTTPS (rfc8484) on HTTP/2.
+// Every query is a POST of its own stream, all streams share one connection
+// per server and worker, and answers come back in whatever order the server
+// finishes them. Connection setup, session resumption, reconnect backoff and
+// keep warm follow TlsResolver, idle connections are probed by PING.
+// thread-unsafe, designed for thread_local use
+class HttpsResolver {
+ public:
+  using tcp_endpoints_type = std::vector<boost::asio::ip::tcp::endpoint>;
+  // path: of the URI template (rfc8484 4.1), e.g. /dns-query
+  HttpsResolver(const std::string& hostname, const std::string& path,
+                const tcp_endpoints_type& endpoints);
+  void Resolve(QueryContext::pointer& query, QueryResultHandler& handler);
+  void Close();
+  // see TlsResolver::set_keep_warm
+  void set_keep_warm(bool keep_warm);
+  bool retry_delayed() const {
+    return io_status_ == IOStatus::INITIALIZATION_DELAYED_FOR_RETRY;
+  }
+
+ private:
+  using tcp = boost::asio::ip::tcp;
+  using stream_type = boost::asio::ssl::stream<tcp::socket>;
+  struct Stream {
+    QueryManager::QueryRecord record;
+    // :status of the response
+    std::string status;
+    // the DNS message of the response behind a tcp length field
+    std::vector<uint8_t> answer;
+  };
+
+  static constexpr std::string_view media_type_ = "application/dns-message";
+  // streams open at once, lowered by SETTINGS_MAX_CONCURRENT_STREAMS
+  static constexpr uint32_t stream_limit_ = 256;
+  // receive windows, every answer fits in the one of its stream
+  static constexpr uint32_t stream_window_size_ = 128 * 1024;
+  static constexpr uint32_t connection_window_size_ = 16 * 1024 * 1024;
+  static constexpr size_t write_size_limit_ = 16 * 1024;
+  static constexpr size_t header_block_size_limit_ = 64 * 1024;
+  static constexpr std::chrono::milliseconds idle_timeout_ =
+      std::chrono::seconds(30);
+  // a connection with open streams or an unanswered PING is reconnected
+  // after this
+  static constexpr std::chrono::milliseconds response_timeout_ =
+      std::chrono::seconds(30);
+
+  boost::asio::ssl::context ssl_context_;
+  std::string session_key_;
+  std::shared_ptr<stream_type> socket_;
+  std::string hostname_;
+  tcp_endpoints_type endpoints_;
+  std::vector<std::chrono::microseconds> endpoint_rtts_;
+  ParallelConnector::pointer connector_;
+  uint16_t retry_connect_counter_ = 0;
+  QueryManager query_manager_;
+  // request headers but content-length, the same for every query
+  std::string request_headers_;
+
+  // HTTP/2 connection state
+  std::unordered_map<uint32_t, Stream> streams_;
+  uint32_t next_stream_id_ = 1;
+  uint32_t max_concurrent_streams_ = stream_limit_;
+  int64_t send_window_ = http2::default_window_size;
+  int64_t peer_initial_window_size_ = http2::default_window_size;
+  uint32_t peer_max_frame_size_ = http2::default_max_frame_size;
+  // received flow controlled bytes not yet given back by WINDOW_UPDATE
+  uint32_t receive_window_consumed_ = 0;
+  // no stream is opened after GOAWAY or once stream IDs run out, the
+  // connection is replaced when the open ones are done
+  bool going_away_ = false;
+  bool ping_pending_ = false;
+  http2::HeaderDecoder header_decoder_;
+  std::vector<http2::HeaderDecoder::Header> headers_;
+  // the header block being received, CONTINUATION frames may follow
+  std::vector<uint8_t> header_block_;
+  uint32_t header_block_stream_id_ = 0;
+  bool header_block_continues_ = false;
+  bool header_block_ends_stream_ = false;
+  // frames to send before new streams: preface, settings, acks, updates
+  std::vector<uint8_t> control_frames_;
+  std::vector<uint8_t> write_buffer_;
+  std::vector<uint8_t> read_buffer_;
+  size_t read_size_ = 0;
+
+  bool keep_warm_ = false;
+  std::chrono::seconds keep_warm_interval_;
+  boost::asio::steady_timer timeout_timer_;
+  std::chrono::milliseconds first_retry_interval_ =
+      std::chrono::milliseconds(500);
+  std::chrono::milliseconds max_retry_interval_ =
+      std::chrono::milliseconds(5 * 60 * 1000);
+  enum class IOStatus {
+    NOT_INITIALIZED,
+    INITIALIZATION_DELAYED_FOR_RETRY,
+    INITIALIZING,
+    // keep it always bigger than READY the value of the status that requires
+    // READY state
+    READY,
+    WRITING,
+  } io_status_ = IOStatus::NOT_INITIALIZED;
+
+  std::chrono::milliseconds IdleTimeout() const;
+  void UpdateSocketTimeout(std::chrono::milliseconds duration);
+  void CloseConnection();
+  void Reconnect();
+  void Connect();
+  void Handshake();
+  void HandleReady();
+  void DoWrite();
+  // moves queued queries into new streams in write_buffer_, returns the
+  // number of streams opened
+  size_t OpenStreams();
+  void DoRead();
+  // returns false on a connection error
+  bool HandleFrame(const http2::FrameHeader& header, const uint8_t* payload);
+  bool HandleHeaderBlock();
+  void HandleSettings(const uint8_t* payload, uint32_t length);
+  void HandleGoaway(uint32_t last_stream_id, uint32_t error_code);
+  void FinishStream(uint32_t stream_id);
+  // the query of the stream is sent again on a new stream
+  void RetryStream(uint32_t stream_id);
+  // puts the queries of open streams back to the queue
+  void RequeueStreams();
+  void DropQuery(QueryManager::QueryRecord& record);
+  static int StoreNewSession(SSL* ssl, SSL_SESSION* session);
+};
+
+}  // namespace dnstoy
+#endif  // DNSTOY_HTTPS_RESOLVER_H_
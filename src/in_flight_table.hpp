@@ -0,0 +1,68 @@
+#ifndef DNSTOY_IN_FLIGHT_TABLE_H_
+#define DNSTOY_IN_FLIGHT_TABLE_H_
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "query.hpp"
+
+namespace dnstoy {
+
+// Queries sent on one upstream connection, indexed by their 16 bit ID.
+// RecordType carries the query record and whatever the transport keeps along.
+// A sparse set: positions_ maps an ID to its entry in the dense records_
+// array and is only trusted if that entry holds the same ID, so stale
+// positions never need to be cleared. Erase moves the last entry into the
+// hole, insert, lookup and erase are O(1) and allocate nothing once records_
+// has grown.
+// thread-unsafe, designed for thread_local use
+template <typename RecordType = QueryManager::QueryRecord>
+class InFlightTable {
+ public:
+  InFlightTable() : positions_(new uint16_t[id_count_]()) {}
+
+  bool empty() const { return records_.empty(); }
+  size_t size() const { return records_.size(); }
+
+  // the ID must not be in the table, QueryIdAllocator guarantees that
+  void Insert(uint16_t id, RecordType&& record) {
+    positions_[id] = static_cast<uint16_t>(records_.size());
+    records_.emplace_back(id, std::move(record));
+  }
+
+  // moves the record of id out, returns false if id is not in flight
+  bool Extract(uint16_t id, RecordType& record) {
+    auto position = positions_[id];
+    if (position >= records_.size() || records_[position].first != id) {
+      return false;
+    }
+    record = std::move(records_[position].second);
+    if (position + 1u != records_.size()) {
+      records_[position] = std::move(records_.back());
+      positions_[records_[position].first] = position;
+    }
+    records_.pop_back();
+    return true;
+  }
+
+  // calls function(id, record) on every record and empties the table
+  template <typename Function>
+  void Drain(Function&& function) {
+    for (auto& [id, record] : records_) {
+      function(id, record);
+    }
+    records_.clear();
+  }
+
+ private:
+  static constexpr size_t id_count_ =
+      size_t(std::numeric_limits<uint16_t>::max()) + 1;
+  std::unique_ptr<uint16_t[]> positions_;
+  std::vector<std::pair<uint16_t, RecordType>> records_;
+};
+
+}  // namespace dnstoy
+#endif  // DNSTOY_IN_FLIGHT_TABLE_H_
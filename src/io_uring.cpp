@@ -0,0 +1,409 @@
+#include "io_uring.hpp"
+
+#if defined(DNSTOY_HAVE_IO_URING)
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "engine.hpp"
+#include "logging.hpp"
+
+namespace dnstoy {
+
+namespace {
+
+inline int io_uring_setup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+inline int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, nullptr, 0));
+}
+
+inline int io_uring_register(int fd, unsigned opcode, void* arg,
+                             unsigned nr_args) {
+  return static_cast<int>(
+      ::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+}  // namespace
+
+IoUring::IoUring() : event_descriptor_(Engine::get().GetExecutor()) {}
+
+IoUring::~IoUring() {
+  Stop();
+  if (sqes_) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_memory_ && cq_memory_ != sq_memory_) {
+    munmap(cq_memory_, cq_memory_size_);
+  }
+  if (sq_memory_) {
+    munmap(sq_memory_, sq_memory_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+bool IoUring::Start(unsigned entries) {
+  if (running_) {
+    return true;
+  }
+  if (ring_fd_ >= 0) {
+    // stopped rings are not reused
+    return false;
+  }
+  io_uring_params params{};
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = entries * 4;
+  ring_fd_ = io_uring_setup(entries, &params);
+  if (ring_fd_ < 0) {
+    LOG_ERROR("io_uring_setup failed: " << strerror(errno));
+    return false;
+  }
+
+  sq_entries_ = params.sq_entries;
+  sq_memory_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_memory_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  auto single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_memory_size_ = cq_memory_size_ =
+        std::max(sq_memory_size_, cq_memory_size_);
+  }
+  auto map = [this](size_t size, off_t offset) -> void* {
+    auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+    return memory == MAP_FAILED ? nullptr : memory;
+  };
+  sq_memory_ = map(sq_memory_size_, IORING_OFF_SQ_RING);
+  cq_memory_ = single_mmap ? sq_memory_ : map(cq_memory_size_,
+                                              IORING_OFF_CQ_RING);
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+  if (!sq_memory_ || !cq_memory_ || !sqes_) {
+    LOG_ERROR("io_uring mmap failed: " << strerror(errno));
+    return false;
+  }
+
+  auto sq = static_cast<uint8_t*>(sq_memory_);
+  sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_ring_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  sq_local_tail_ = *sq_tail_;
+  auto cq = static_cast<uint8_t*>(cq_memory_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_ring_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  auto event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd < 0) {
+    LOG_ERROR("eventfd failed: " << strerror(errno));
+    return false;
+  }
+  if (io_uring_register(ring_fd_, IORING_REGISTER_EVENTFD, &event_fd, 1) <
+      0) {
+    LOG_ERROR("io_uring register eventfd failed: " << strerror(errno));
+    close(event_fd);
+    return false;
+  }
+  event_descriptor_.assign(event_fd);
+  running_ = true;
+  LOG_INFO("io_uring started, " << sq_entries_ << " entries");
+  DoWaitCompletion();
+  return true;
+}
+
+void IoUring::Stop() {
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  for (size_t i = 0; i < operations_.size(); i++) {
+    if (operations_[i]) {
+      Cancel(i + 1);
+    }
+  }
+  Submit();
+  while (active_operations_) {
+    if (io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+        errno != EINTR) {
+      LOG_ERROR("io_uring_enter failed: " << strerror(errno));
+      break;
+    }
+    Reap();
+  }
+  boost::system::error_code error;
+  event_descriptor_.close(error);
+}
+
+bool IoUring::RegisterBufferRing(BufferRing& ring, uint16_t entries,
+                                 size_t buffer_size) {
+  if (!running_) {
+    return false;
+  }
+  // ring entries must be a power of 2
+  uint16_t ring_entries = 1;
+  while (ring_entries < entries && ring_entries < (1 << 15)) {
+    ring_entries <<= 1;
+  }
+  ring.ring_memory_size_ = ring_entries * sizeof(io_uring_buf);
+  auto memory = mmap(nullptr, ring.ring_memory_size_, PROT_READ | PROT_WRITE,
+                     MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (memory == MAP_FAILED) {
+    LOG_ERROR("buffer ring mmap failed: " << strerror(errno));
+    return false;
+  }
+  ring.ring_ = static_cast<io_uring_buf_ring*>(memory);
+  ring.entries_ = ring_entries;
+  ring.group_ = next_buffer_group_++;
+  ring.buffer_size_ = buffer_size;
+  ring.buffers_.resize(buffer_size * ring_entries);
+
+  io_uring_buf_reg registration{};
+  registration.ring_addr = reinterpret_cast<uintptr_t>(ring.ring_);
+  registration.ring_entries = ring_entries;
+  registration.bgid = ring.group_;
+  if (io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &registration,
+                        1) < 0) {
+    LOG_ERROR("io_uring register buffer ring failed: " << strerror(errno));
+    munmap(ring.ring_, ring.ring_memory_size_);
+    ring.ring_ = nullptr;
+    ring.buffers_.clear();
+    return false;
+  }
+  for (uint16_t i = 0; i < ring_entries; i++) {
+    ring.Recycle(i);
+  }
+  return true;
+}
+
+void IoUring::UnregisterBufferRing(BufferRing& ring) {
+  if (!ring.ring_) {
+    return;
+  }
+  if (ring_fd_ >= 0) {
+    io_uring_buf_reg registration{};
+    registration.bgid = ring.group_;
+    io_uring_register(ring_fd_, IORING_UNREGISTER_PBUF_RING, &registration,
+                      1);
+  }
+  munmap(ring.ring_, ring.ring_memory_size_);
+  ring.ring_ = nullptr;
+  ring.buffers_.clear();
+}
+
+void IoUring::BufferRing::Recycle(uint16_t index) {
+  // only this thread writes the tail, the kernel reads it
+  auto tail = ring_->tail;
+  // the ring is an array of io_uring_buf whose first reserved field is the
+  // tail, bufs is not used as its flexible array layout differs in C++
+  auto& entry =
+      reinterpret_cast<io_uring_buf*>(ring_)[tail & (entries_ - 1)];
+  entry.addr = reinterpret_cast<uintptr_t>(buffer(index));
+  entry.len = buffer_size_;
+  entry.bid = index;
+  __atomic_store_n(&ring_->tail, static_cast<uint16_t>(tail + 1),
+                   __ATOMIC_RELEASE);
+}
+
+IoUring::OperationID IoUring::RecvMsgMultishot(int fd, msghdr* message,
+                                               BufferRing& ring,
+                                               CompletionHandler&& handler) {
+  if (!running_) {
+    return 0;
+  }
+  auto sqe = GetSqe();
+  if (!sqe) {
+    return 0;
+  }
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uintptr_t>(message);
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = ring.group();
+  sqe->user_data = AddOperation(std::move(handler));
+  return sqe->user_data;
+}
+
+IoUring::OperationID IoUring::AcceptMultishot(int fd,
+                                              CompletionHandler&& handler) {
+  if (!running_) {
+    return 0;
+  }
+  auto sqe = GetSqe();
+  if (!sqe) {
+    return 0;
+  }
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = AddOperation(std::move(handler));
+  return sqe->user_data;
+}
+
+IoUring::OperationID IoUring::SendMsg(int fd, const msghdr* message,
+                                      CompletionHandler&& handler) {
+  if (!running_) {
+    return 0;
+  }
+  auto sqe = GetSqe();
+  if (!sqe) {
+    return 0;
+  }
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uintptr_t>(message);
+  sqe->len = 1;
+  sqe->user_data = AddOperation(std::move(handler));
+  return sqe->user_data;
+}
+
+void IoUring::Cancel(OperationID operation) {
+  if (!operation || ring_fd_ < 0) {
+    return;
+  }
+  auto sqe = GetSqe();
+  if (!sqe) {
+    return;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = operation;
+  // completion of cancel request itself is ignored
+  sqe->user_data = 0;
+}
+
+io_uring_sqe* IoUring::GetSqe() {
+  if (ring_fd_ < 0) {
+    return nullptr;
+  }
+  auto head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sq_local_tail_ - head >= sq_entries_) {
+    Submit();
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_local_tail_ - head >= sq_entries_) {
+      LOG_ERROR("io_uring submission queue is full");
+      return nullptr;
+    }
+  }
+  auto index = sq_local_tail_ & *sq_ring_mask_;
+  auto sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  sq_local_tail_++;
+  sq_pending_++;
+  ScheduleSubmit();
+  return sqe;
+}
+
+IoUring::OperationID IoUring::AddOperation(CompletionHandler&& handler) {
+  active_operations_++;
+  if (!free_operations_.empty()) {
+    auto operation = free_operations_.back();
+    free_operations_.pop_back();
+    operations_[operation - 1] = std::move(handler);
+    return operation;
+  }
+  operations_.emplace_back(std::move(handler));
+  return operations_.size();
+}
+
+void IoUring::ScheduleSubmit() {
+  if (submit_scheduled_ || !running_) {
+    return;
+  }
+  submit_scheduled_ = true;
+  boost::asio::post(Engine::get().GetExecutor(), [this]() { Submit(); });
+}
+
+void IoUring::Submit() {
+  submit_scheduled_ = false;
+  if (!sq_pending_) {
+    return;
+  }
+  __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+  while (sq_pending_) {
+    auto submitted = io_uring_enter(ring_fd_, sq_pending_, 0, 0);
+    if (submitted < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EBUSY) {
+        // completion queue is overflowing, consume it and try again later
+        Reap();
+        ScheduleSubmit();
+        return;
+      }
+      LOG_ERROR("io_uring_enter failed: " << strerror(errno));
+      return;
+    }
+    sq_pending_ -= std::min<unsigned>(submitted, sq_pending_);
+  }
+}
+
+void IoUring::DoWaitCompletion() {
+  event_descriptor_.async_wait(
+      boost::asio::posix::stream_descriptor::wait_read,
+      [this](boost::system::error_code error) {
+        if (error) {
+          return;
+        }
+        uint64_t value;
+        if (read(event_descriptor_.native_handle(), &value, sizeof(value)) <
+                0 &&
+            errno != EAGAIN) {
+          LOG_ERROR("read eventfd failed: " << strerror(errno));
+        }
+        Reap();
+        if (running_) {
+          DoWaitCompletion();
+        }
+      });
+}
+
+void IoUring::Reap() {
+  while (true) {
+    // handlers may reap again, so always continue from the shared head
+    auto head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+    auto& cqe = cqes_[head & *cq_ring_mask_];
+    auto operation = cqe.user_data;
+    auto result = cqe.res;
+    auto flags = cqe.flags;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    if (!operation || operation > operations_.size()) {
+      continue;
+    }
+    if (flags & IORING_CQE_F_MORE) {
+      operations_[operation - 1](result, flags);
+      continue;
+    }
+    // last completion of the operation
+    auto handler = std::move(operations_[operation - 1]);
+    operations_[operation - 1] = nullptr;
+    free_operations_.push_back(operation);
+    active_operations_--;
+    if (handler) {
+      handler(result, flags);
+    }
+  }
+}
+
+}  // namespace dnstoy
+#endif  // defined(DNSTOY_HAVE_IO_URING)
@@ -0,0 +1,121 @@
+#ifndef DNSTOY_IO_URING_H_
+#define DNSTOY_IO_URING_H_
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#define DNSTOY_HAVE_IO_URING 1
+#endif  // defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <boost/asio.hpp>
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace dnstoy {
+
+#if defined(DNSTOY_HAVE_IO_URING)
+
+// io_uring backend for the listeners.
+// Submissions made during one round of the event loop are flushed by one
+// io_uring_enter, completions are drained from the mapped completion queue
+// after the ring's eventfd wakes up the asio executor of this thread.
+// thread-unsafe, designed for thread_local use
+class IoUring {
+ public:
+  // called with cqe res & flags, an operation keeps alive while its
+  // completions carry IORING_CQE_F_MORE
+  using CompletionHandler = std::function<void(int32_t, uint32_t)>;
+  using OperationID = uint64_t;
+
+  // kernel provided buffers, a multishot receive picks one for every
+  // datagram and reports its index in the completion flags
+  class BufferRing {
+   public:
+    uint16_t group() const { return group_; }
+    size_t buffer_size() const { return buffer_size_; }
+    uint8_t* buffer(uint16_t index) {
+      return buffers_.data() + buffer_size_ * index;
+    }
+    void Recycle(uint16_t index);
+
+   private:
+    friend class IoUring;
+    io_uring_buf_ring* ring_ = nullptr;
+    size_t ring_memory_size_ = 0;
+    uint16_t entries_ = 0;
+    uint16_t group_ = 0;
+    size_t buffer_size_ = 0;
+    std::vector<uint8_t> buffers_;
+  };
+
+  static inline IoUring& get() {
+    static thread_local IoUring object;
+    return object;
+  }
+
+  // returns false if the kernel refuses to set up a ring
+  bool Start(unsigned entries);
+  // cancels all operations and waits for their last completion
+  void Stop();
+  bool running() const { return running_; }
+
+  bool RegisterBufferRing(BufferRing& ring, uint16_t entries,
+                          size_t buffer_size);
+  void UnregisterBufferRing(BufferRing& ring);
+
+  OperationID RecvMsgMultishot(int fd, msghdr* message, BufferRing& ring,
+                               CompletionHandler&& handler);
+  OperationID AcceptMultishot(int fd, CompletionHandler&& handler);
+  OperationID SendMsg(int fd, const msghdr* message,
+                      CompletionHandler&& handler);
+  void Cancel(OperationID operation);
+
+  ~IoUring();
+
+ private:
+  int ring_fd_ = -1;
+  bool running_ = false;
+  bool submit_scheduled_ = false;
+  uint16_t next_buffer_group_ = 0;
+  boost::asio::posix::stream_descriptor event_descriptor_;
+
+  // mapped submission queue
+  void* sq_memory_ = nullptr;
+  size_t sq_memory_size_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_ring_mask_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+  unsigned sq_entries_ = 0;
+  // sqes before this tail are filled, they become visible to the kernel on
+  // next submit
+  unsigned sq_local_tail_ = 0;
+  unsigned sq_pending_ = 0;
+  // mapped completion queue
+  void* cq_memory_ = nullptr;
+  size_t cq_memory_size_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_ring_mask_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+
+  // handlers indexed by user_data - 1, deque keeps them in place while new
+  // operations are submitted from inside a handler
+  std::deque<CompletionHandler> operations_;
+  std::vector<OperationID> free_operations_;
+  size_t active_operations_ = 0;
+
+  IoUring();
+  io_uring_sqe* GetSqe();
+  OperationID AddOperation(CompletionHandler&& handler);
+  void ScheduleSubmit();
+  void Submit();
+  void DoWaitCompletion();
+  void Reap();
+};
+
+#endif  // defined(DNSTOY_HAVE_IO_URING)
+
+}  // namespace dnstoy
+#endif  // DNSTOY_IO_URING_H_
@@ -0,0 +1,196 @@
+#include "kernel_tls.hpp"
+
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/tls1.h>
+
+#include <cstring>
+#include <string>
+
+#include "logging.hpp"
+
+#if defined(DNSTOY_HAVE_KERNEL_TLS)
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#endif  // defined(DNSTOY_HAVE_KERNEL_TLS)
+
+namespace dnstoy {
+
+namespace {
+
+constexpr char client_traffic_secret_label[] = "CLIENT_TRAFFIC_SECRET_0 ";
+
+inline int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+#if defined(DNSTOY_HAVE_KERNEL_TLS)
+
+// rfc8446 7.1: HKDF-Expand-Label(secret, label, "", length)
+bool ExpandLabel(const EVP_MD* digest, const std::vector<uint8_t>& secret,
+                 const std::string& label, uint8_t* output, size_t length) {
+  std::string full_label = "tls13 " + label;
+  std::vector<uint8_t> info;
+  info.push_back(static_cast<uint8_t>(length >> 8));
+  info.push_back(static_cast<uint8_t>(length & 0xff));
+  info.push_back(static_cast<uint8_t>(full_label.size()));
+  info.insert(info.end(), full_label.begin(), full_label.end());
+  info.push_back(0);  // empty context
+
+  auto context = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+  if (!context) {
+    return false;
+  }
+  auto result =
+      EVP_PKEY_derive_init(context) > 0 &&
+      EVP_PKEY_CTX_hkdf_mode(context, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0 &&
+      EVP_PKEY_CTX_set_hkdf_md(context, digest) > 0 &&
+      EVP_PKEY_CTX_set1_hkdf_key(context, secret.data(), secret.size()) > 0 &&
+      EVP_PKEY_CTX_add1_hkdf_info(context, info.data(), info.size()) > 0 &&
+      EVP_PKEY_derive(context, output, &length) > 0;
+  EVP_PKEY_CTX_free(context);
+  return result;
+}
+
+// GCM ciphers take the first 4 bytes of the 12 bytes IV as salt, the record
+// sequence number starts from 0 as the application traffic key is new
+template <typename CryptoInfo>
+bool Install(int fd, uint16_t cipher_type, const uint8_t* key,
+             const uint8_t* iv) {
+  CryptoInfo crypto_info;
+  memset(&crypto_info, 0, sizeof(crypto_info));
+  crypto_info.info.version = TLS_1_3_VERSION;
+  crypto_info.info.cipher_type = cipher_type;
+  memcpy(crypto_info.key, key, sizeof(crypto_info.key));
+  memcpy(crypto_info.salt, iv, sizeof(crypto_info.salt));
+  memcpy(crypto_info.iv, iv + sizeof(crypto_info.salt),
+         sizeof(crypto_info.iv));
+  auto result =
+      setsockopt(fd, SOL_TLS, TLS_TX, &crypto_info, sizeof(crypto_info));
+  OPENSSL_cleanse(&crypto_info, sizeof(crypto_info));
+  return result == 0;
+}
+
+#endif  // defined(DNSTOY_HAVE_KERNEL_TLS)
+
+}  // namespace
+
+bool KernelTls::ParseClientTrafficSecret(const char* line,
+                                         std::vector<uint8_t>& secret) {
+  constexpr auto label_size = sizeof(client_traffic_secret_label) - 1;
+  if (strncmp(line, client_traffic_secret_label, label_size) != 0) {
+    return false;
+  }
+  // skip the client random
+  auto hex = strchr(line + label_size, ' ');
+  if (!hex) {
+    return false;
+  }
+  hex++;
+  secret.clear();
+  for (; hex[0] && hex[1]; hex += 2) {
+    auto high = HexValue(hex[0]);
+    auto low = HexValue(hex[1]);
+    if (high < 0 || low < 0) {
+      secret.clear();
+      return false;
+    }
+    secret.push_back(static_cast<uint8_t>(high << 4 | low));
+  }
+  return !secret.empty();
+}
+
+#if defined(DNSTOY_HAVE_KERNEL_TLS)
+
+bool KernelTls::EnableTransmit(SSL* ssl, int fd,
+                               const std::vector<uint8_t>& secret) {
+  if (SSL_version(ssl) != TLS1_3_VERSION || secret.empty()) {
+    return false;
+  }
+  auto cipher = SSL_get_current_cipher(ssl);
+  if (!cipher) {
+    return false;
+  }
+  auto cipher_id = SSL_CIPHER_get_id(cipher);
+  size_t key_size;
+  switch (cipher_id) {
+    case TLS1_3_CK_AES_128_GCM_SHA256:
+      key_size = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+      break;
+    case TLS1_3_CK_AES_256_GCM_SHA384:
+      key_size = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+      break;
+    case TLS1_3_CK_CHACHA20_POLY1305_SHA256:
+      key_size = TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE;
+      break;
+    default:
+      LOG_DEBUG(<< "cipher " << SSL_CIPHER_get_name(cipher)
+                << " is not supported by kernel tls");
+      return false;
+  }
+
+  if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+    LOG_DEBUG(<< "kernel tls is not available: " << strerror(errno));
+    return false;
+  }
+
+  uint8_t key[32];
+  uint8_t iv[12];
+  auto digest = SSL_CIPHER_get_handshake_digest(cipher);
+  auto result = false;
+  if (ExpandLabel(digest, secret, "key", key, key_size) &&
+      ExpandLabel(digest, secret, "iv", iv, sizeof(iv))) {
+    switch (cipher_id) {
+      case TLS1_3_CK_AES_128_GCM_SHA256:
+        result = Install<tls12_crypto_info_aes_gcm_128>(
+            fd, TLS_CIPHER_AES_GCM_128, key, iv);
+        break;
+      case TLS1_3_CK_AES_256_GCM_SHA384:
+        result = Install<tls12_crypto_info_aes_gcm_256>(
+            fd, TLS_CIPHER_AES_GCM_256, key, iv);
+        break;
+      default:
+        result = Install<tls12_crypto_info_chacha20_poly1305>(
+            fd, TLS_CIPHER_CHACHA20_POLY1305, key, iv);
+    }
+  }
+  OPENSSL_cleanse(key, sizeof(key));
+  OPENSSL_cleanse(iv, sizeof(iv));
+  // an attached ULP without keys passes data through, so failing here
+  // leaves the connection usable by OpenSSL
+  if (!result) {
+    LOG_DEBUG(<< "kernel tls refused the keys: " << strerror(errno));
+    return false;
+  }
+  // the read BIO keeps its own reference of the BIO pair
+  SSL_set0_wbio(ssl, BIO_new(BIO_s_null()));
+  return true;
+}
+
+#else
+
+bool KernelTls::EnableTransmit(SSL* /*ssl*/, int /*fd*/,
+                               const std::vector<uint8_t>& /*secret*/) {
+  return false;
+}
+
+#endif  // defined(DNSTOY_HAVE_KERNEL_TLS)
+
+bool KernelTls::OpenSslOutputDiscarded(SSL* ssl) {
+  return BIO_number_written(SSL_get_wbio(ssl)) > 0;
+}
+
+}  // namespace dnstoy
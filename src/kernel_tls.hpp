@@ -0,0 +1,39 @@
+#ifndef DNSTOY_KERNEL_TLS_H_
+#define DNSTOY_KERNEL_TLS_H_
+#if defined(__linux__) && __has_include(<linux/tls.h>)
+#define DNSTOY_HAVE_KERNEL_TLS 1
+#endif  // defined(__linux__) && __has_include(<linux/tls.h>)
+#include <openssl/ssl.h>
+
+#include <vector>
+
+namespace dnstoy {
+
+// Kernel TLS (kTLS) transmit offload of TLS 1.3 connections.
+// Once the handshake is done, the client application traffic key is
+// installed to the TLS ULP of the socket, then queries are written to the
+// socket as plaintext and the kernel builds the records.
+// Receiving stays with OpenSSL, which handles the post handshake messages
+// like NewSessionTicket. The records OpenSSL writes of its own from then on,
+// like the KeyUpdate a server may ask for, would be protected by OpenSSL and
+// wrapped again by the kernel, so they go to a sink instead and the
+// connection is replaced before it writes again.
+class KernelTls {
+ public:
+  // for the keylog callback, returns true and fills secret if line carries
+  // the client application traffic secret
+  static bool ParseClientTrafficSecret(const char* line,
+                                       std::vector<uint8_t>& secret);
+  // returns false if the kernel lacks kTLS or the negotiated version or
+  // cipher is not supported, the connection then keeps writing by OpenSSL.
+  // Must be called right after the handshake, before any application data
+  // is written by OpenSSL. On success the writes of OpenSSL are discarded.
+  static bool EnableTransmit(SSL* ssl, int fd,
+                             const std::vector<uint8_t>& secret);
+  // returns true once OpenSSL wrote a record since EnableTransmit, the peer
+  // then misses it on this connection
+  static bool OpenSslOutputDiscarded(SSL* ssl);
+};
+
+}  // namespace dnstoy
+#endif  // DNSTOY_KERNEL_TLS_H_
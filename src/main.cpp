@@ -1,9 +1,13 @@
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
+#include <thread>
+#include <vector>
 #include "configuration.hpp"
 #include "logging.hpp"
 #include "resolver.hpp"
 #include "server.hpp"
+#include "tls_session_store.hpp"
 #include "version.h"
 
 using boost::asio::ip::udp;
@@ -11,8 +15,18 @@ using dnstoy::Configuration;
 using dnstoy::InitLogging;
 using dnstoy::Resolver;
 using dnstoy::Server;
+using dnstoy::TlsSessionStore;
 using std::cout;
 
+static void RunWorker() {
+  // every worker owns a thread_local Engine, so the server, proxy contexts
+  // and remote server connections below are never shared between threads
+  Server server;
+  server.StartTcp();
+  server.StartUdp();
+  server.Run();
+}
+
 int main(int argc, const char **argv) {
   InitLogging();
   LOG_INFO("dnstoy version:" << DNSTOY_VERSION << " pid:" << getpid());
@@ -25,9 +39,27 @@ int main(int argc, const char **argv) {
     return result;
   }
 
-  Server server;
-  server.StartTcp();
-  server.StartUdp();
-  server.Run();
+  auto session_file = Configuration::get("tls-session-file").as<std::string>();
+  if (!session_file.empty() && !TlsSessionStore::get().Load(session_file)) {
+    return -1;
+  }
+
+  auto worker_count = Configuration::get("worker-threads").as<uint32_t>();
+  if (worker_count == 0) {
+    worker_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  LOG_INFO("Starting " << worker_count << " worker(s)");
+
+  std::vector<std::thread> workers;
+  for (uint32_t i = 1; i < worker_count; i++) {
+    workers.emplace_back(RunWorker);
+  }
+  RunWorker();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  if (!session_file.empty()) {
+    TlsSessionStore::get().Save(session_file);
+  }
   LOG_INFO("Exit.");
-}
\ No newline at end of file
+}
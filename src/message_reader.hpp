@@ -1,5 +1,10 @@
 #ifndef DNSTOY_MESSAGE_READER_H_
 #define DNSTOY_MESSAGE_READER_H_
+#if defined(__linux__)
+#include <sys/socket.h>
+#define DNSTOY_HAVE_MMSG 1
+#endif  // defined(__linux__)
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/endian/conversion.hpp>
@@ -17,6 +22,7 @@ class MessageReader {
     NEW_MESSAGE,
     IO_ERROR,
     MANUAL_STOPPED,
+    PEER_CLOSED,
   };
 
   using StreamHandlerTypeExample =
@@ -25,6 +31,13 @@ class MessageReader {
       Reason, const uint8_t*, uint16_t, boost::asio::ip::udp::endpoint*)>;
 
   void resize_buffer(size_t size) { buffer_.resize(size); }
+  size_t buffer_size() const { return buffer_.size(); }
+
+  // datagrams read by one wakeup, every datagram gets a buffer of the size
+  // passed to resize_buffer
+  void resize_udp_batch(size_t batch_size) {
+    udp_batch_size_ = std::max<size_t>(batch_size, 1);
+  }
 
   void reset() {
     status_ = Status::STOP;
@@ -70,6 +83,69 @@ class MessageReader {
   boost::asio::ip::udp::endpoint udp_endpoint_;
 
   std::vector<uint8_t> buffer_;
+  size_t udp_batch_size_ = 1;
+#if defined(DNSTOY_HAVE_MMSG)
+  std::vector<uint8_t> udp_batch_buffer_;
+  std::vector<boost::asio::ip::udp::endpoint> udp_endpoints_;
+  std::vector<iovec> udp_iovecs_;
+  std::vector<mmsghdr> udp_messages_;
+
+  void PrepareUdpBatch() {
+    if (udp_messages_.size() == udp_batch_size_) {
+      return;
+    }
+    auto slot_size = buffer_.size();
+    udp_batch_buffer_.resize(slot_size * udp_batch_size_);
+    udp_endpoints_.resize(udp_batch_size_);
+    udp_iovecs_.resize(udp_batch_size_);
+    udp_messages_.resize(udp_batch_size_);
+    for (size_t i = 0; i < udp_batch_size_; i++) {
+      udp_iovecs_[i].iov_base = udp_batch_buffer_.data() + slot_size * i;
+      udp_iovecs_[i].iov_len = slot_size;
+    }
+  }
+
+  // returns count of received datagrams, 0 when nothing is available
+  template <typename HandlerType>
+  size_t ReceiveUdpBatch(boost::asio::ip::udp::socket& socket,
+                         HandlerType& handler,
+                         boost::system::error_code& error) {
+    PrepareUdpBatch();
+    for (size_t i = 0; i < udp_batch_size_; i++) {
+      auto& header = udp_messages_[i].msg_hdr;
+      header = {};
+      header.msg_name = udp_endpoints_[i].data();
+      header.msg_namelen = udp_endpoints_[i].capacity();
+      header.msg_iov = &udp_iovecs_[i];
+      header.msg_iovlen = 1;
+      udp_messages_[i].msg_len = 0;
+    }
+    auto count = ::recvmmsg(socket.native_handle(), udp_messages_.data(),
+                            udp_messages_.size(), MSG_DONTWAIT, nullptr);
+    if (count < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        error = boost::system::error_code(
+            errno, boost::asio::error::get_system_category());
+      }
+      return 0;
+    }
+    for (int i = 0; i < count; i++) {
+      auto& message = udp_messages_[i];
+      if (message.msg_hdr.msg_flags & MSG_TRUNC) {
+        LOG_ERROR("udp message larger than " << buffer_.size() << " dropped");
+        continue;
+      }
+      udp_endpoints_[i].resize(message.msg_hdr.msg_namelen);
+      handler(Reason::NEW_MESSAGE,
+              static_cast<const uint8_t*>(udp_iovecs_[i].iov_base),
+              message.msg_len, &udp_endpoints_[i]);
+      if (status_ == Status::STOP) {
+        break;
+      }
+    }
+    return count;
+  }
+#endif  // defined(DNSTOY_HAVE_MMSG)
 
   template <typename StreamPointerType, typename HandlerType>
   void DoReadStream(StreamPointerType stream_pointer, HandlerType&& handler) {
@@ -89,10 +165,11 @@ class MessageReader {
       data_offset_ = 0;
     }
     auto available_size = buffer_.size() - data_offset_ - data_size_;
-    auto read_size = tcp_message_size_ - data_size_;
-    if (!read_size) {
-      read_size = sizeof(dns::RawTcpMessage::message_length);
-    }
+    // a read may end within the length field, whose rest comes first
+    auto read_size = tcp_message_size_
+                         ? tcp_message_size_ - data_size_
+                         : sizeof(dns::RawTcpMessage::message_length) -
+                               data_size_;
     if (available_size < read_size) {
       if (data_offset_ + available_size > read_size) {
         memmove(buffer_.data(), buffer_.data() + data_offset_, data_size_);
@@ -114,13 +191,19 @@ class MessageReader {
                              boost::system::error_code error,
                              size_t new_data_size) {
       if (error) {
-        if (error == boost::asio::error::eof ||
-            error == boost::system::errc::operation_canceled) {
+        if (error == boost::system::errc::operation_canceled) {
           LOG_TRACE("connection closed");
-          // TODO: add a handler reason for this
           status_ = Status::STOP;
           return;
         }
+        // tls peers may close without close_notify
+        if (error == boost::asio::error::eof ||
+            error == boost::asio::ssl::error::stream_truncated) {
+          LOG_TRACE("connection closed by peer");
+          status_ = Status::STOP;
+          handler(Reason::PEER_CLOSED, nullptr, 0);
+          return;
+        }
         LOG_ERROR(<< error.message());
         handler(Reason::IO_ERROR, nullptr, 0);
         status_ = Status::STOP;
@@ -171,6 +254,40 @@ class MessageReader {
       LOG_TRACE("connection closed");
       return;
     }
+#if defined(DNSTOY_HAVE_MMSG)
+    if (udp_batch_size_ > 1) {
+      // wait for readiness and drain the socket with recvmmsg, so a burst of
+      // queries costs a few syscalls instead of one per datagram
+      socket.async_wait(
+          boost::asio::ip::udp::socket::wait_read,
+          [this, &socket,
+           handler = std::move(handler)](boost::system::error_code error) {
+            if (!error) {
+              // leave the loop after a bounded number of batches so other
+              // handlers in this engine are not starved under flood
+              for (auto i = 0; i < 4 && status_ == Status::RUNNING; i++) {
+                if (ReceiveUdpBatch(socket, handler, error) <
+                    udp_batch_size_) {
+                  break;
+                }
+              }
+            }
+            if (error) {
+              if (error == boost::system::errc::operation_canceled) {
+                LOG_TRACE("connection closed");
+                status_ = Status::STOP;
+                return;
+              }
+              LOG_ERROR(<< error.message());
+              handler(Reason::IO_ERROR, nullptr, 0, nullptr);
+              status_ = Status::STOP;
+              return;
+            }
+            DoReadUdp(socket, std::move(handler));
+          });
+      return;
+    }
+#endif  // defined(DNSTOY_HAVE_MMSG)
     socket.async_receive_from(
         boost::asio::buffer(buffer_), udp_endpoint_,
         [this, &socket, handler = std::move(handler)](
@@ -0,0 +1,142 @@
+#include "parallel_connector.hpp"
+
+#include <algorithm>
+
+#include "logging.hpp"
+
+using boost::system::error_code;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+
+namespace dnstoy {
+
+#if defined(TCP_THIN_LINEAR_TIMEOUTS)
+// a lost segment of a thin stream, few small segments in flight, is rarely
+// followed by enough segments for fast retransmit. Linear instead of
+// exponential retransmission timeouts shorten the stall of every query behind
+// it (Documentation/networking/tcp-thin.rst)
+using thin_linear_timeouts = boost::asio::detail::socket_option::boolean<
+    IPPROTO_TCP, TCP_THIN_LINEAR_TIMEOUTS>;
+#endif  // defined(TCP_THIN_LINEAR_TIMEOUTS)
+
+void ParallelConnector::Start(const std::vector<tcp::endpoint>& endpoints,
+                              std::vector<size_t> order, Handler&& handler) {
+  endpoints_ = endpoints;
+  order_ = std::move(order);
+  handler_ = std::move(handler);
+  if (order_.empty()) {
+    Finish(boost::asio::error::host_not_found, nullptr);
+    return;
+  }
+  StartNextAttempt();
+}
+
+std::vector<size_t> ParallelConnector::PreferredOrder(
+    const std::vector<tcp::endpoint>& endpoints,
+    const std::vector<microseconds>& rtts) {
+  std::vector<size_t> v6, v4, order;
+  for (size_t i = 0; i < endpoints.size(); i++) {
+    (endpoints[i].address().is_v6() ? v6 : v4).push_back(i);
+  }
+  for (size_t i = 0; i < std::max(v6.size(), v4.size()); i++) {
+    if (i < v6.size()) {
+      order.push_back(v6[i]);
+    }
+    if (i < v4.size()) {
+      order.push_back(v4[i]);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&rtts](size_t a, size_t b) { return rtts[a] < rtts[b]; });
+  return order;
+}
+
+void ParallelConnector::Cancel() {
+  finished_ = true;
+  delay_timer_.cancel();
+  for (auto& attempt : attempts_) {
+    error_code error;
+    attempt->socket.close(error);
+  }
+  handler_ = nullptr;
+}
+
+void ParallelConnector::StartNextAttempt() {
+  if (finished_ || next_ >= order_.size()) {
+    return;
+  }
+  auto endpoint_index = order_[next_++];
+  attempts_.emplace_back(new Attempt{endpoint_index, tcp::socket(io_context_),
+                                     steady_clock::now()});
+  auto& attempt = *attempts_.back();
+  running_++;
+  LOG_TRACE(<< "connecting " << endpoints_[endpoint_index]);
+  attempt.socket.async_connect(
+      endpoints_[endpoint_index],
+      [this, self = shared_from_this(), &attempt](const error_code& error) {
+        HandleConnect(attempt, error);
+      });
+
+  if (next_ < order_.size()) {
+    delay_timer_.expires_after(attempt_delay);
+    delay_timer_.async_wait(
+        [this, self = shared_from_this()](const error_code& error) {
+          if (!error) {
+            StartNextAttempt();
+          }
+        });
+  }
+}
+
+void ParallelConnector::HandleConnect(Attempt& attempt,
+                                      const error_code& error) {
+  running_--;
+  if (finished_) {
+    return;
+  }
+  if (!error) {
+    Finish(error, &attempt);
+    return;
+  }
+  LOG_DEBUG(<< "connect " << endpoints_[attempt.endpoint_index]
+            << " failed: " << error.message());
+  failed_endpoints_.push_back(attempt.endpoint_index);
+  last_error_ = error;
+  if (next_ < order_.size()) {
+    // do not wait for the delay once an attempt failed
+    delay_timer_.cancel();
+    StartNextAttempt();
+  } else if (!running_) {
+    Finish(last_error_, nullptr);
+  }
+}
+
+void ParallelConnector::Finish(const error_code& error, Attempt* winner) {
+  finished_ = true;
+  delay_timer_.cancel();
+  for (auto& attempt : attempts_) {
+    if (attempt.get() != winner) {
+      error_code close_error;
+      attempt->socket.close(close_error);
+    }
+  }
+  auto handler = std::move(handler_);
+  handler_ = nullptr;
+  if (winner) {
+    // queries are small and waited for, none is held back by Nagle behind
+    // unacked ones
+    error_code option_error;
+    winner->socket.set_option(tcp::no_delay(true), option_error);
+#if defined(TCP_THIN_LINEAR_TIMEOUTS)
+    winner->socket.set_option(thin_linear_timeouts(true), option_error);
+#endif  // defined(TCP_THIN_LINEAR_TIMEOUTS)
+    handler(error, std::move(winner->socket), winner->endpoint_index,
+            duration_cast<microseconds>(steady_clock::now() -
+                                        winner->start_time));
+  } else {
+    handler(error, tcp::socket(io_context_), 0, microseconds(0));
+  }
+}
+
+}  // namespace dnstoy
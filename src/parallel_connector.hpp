@@ -0,0 +1,90 @@
+#ifndef DNSTOY_PARALLEL_CONNECTOR_H_
+#define DNSTOY_PARALLEL_CONNECTOR_H_
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace dnstoy {
+
+// Connects to the first answering endpoint of a list (rfc8305 5).
+// Attempts start in the given order, the next one starts when the previous
+// fails or after attempt_delay, whichever comes first. The first established
+// connection wins and the other attempts are closed. The winning socket is
+// set up for query traffic: TCP_NODELAY, and linear retransmission timeouts
+// on linux.
+// thread-unsafe, designed for thread_local use
+class ParallelConnector
+    : public std::enable_shared_from_this<ParallelConnector> {
+ public:
+  using pointer = std::shared_ptr<ParallelConnector>;
+  using tcp = boost::asio::ip::tcp;
+  // rtt: time the winning attempt took, error is set if every attempt failed
+  using Handler =
+      std::function<void(const boost::system::error_code& error,
+                         tcp::socket&& socket, size_t endpoint_index,
+                         std::chrono::microseconds rtt)>;
+  // rfc8305 8: recommended connection attempt delay
+  static constexpr std::chrono::milliseconds attempt_delay{250};
+  // connect time of endpoints never connected, and of failed ones
+  static constexpr std::chrono::microseconds unmeasured_rtt =
+      std::chrono::seconds(1);
+  static constexpr std::chrono::microseconds failed_rtt =
+      std::chrono::seconds(10);
+
+  static pointer create(boost::asio::io_context& io_context) {
+    return pointer(new ParallelConnector(io_context));
+  }
+
+  // order: indexes of endpoints to try, most preferred first
+  void Start(const std::vector<tcp::endpoint>& endpoints,
+             std::vector<size_t> order, Handler&& handler);
+  // closes every attempt, the handler is not called afterwards
+  void Cancel();
+  // endpoint indexes whose attempts failed before a winner was found
+  const std::vector<size_t>& failed_endpoints() const {
+    return failed_endpoints_;
+  }
+
+  // rfc8305 4: alternates address families starting with IPv6, then puts
+  // the fastest known endpoint first and failed ones last
+  static std::vector<size_t> PreferredOrder(
+      const std::vector<tcp::endpoint>& endpoints,
+      const std::vector<std::chrono::microseconds>& rtts);
+  // folds the connect time of the winning attempt into the endpoint's
+  static void RecordRtt(std::chrono::microseconds& endpoint_rtt,
+                        std::chrono::microseconds rtt) {
+    endpoint_rtt =
+        endpoint_rtt >= unmeasured_rtt ? rtt : (endpoint_rtt * 3 + rtt) / 4;
+  }
+
+ private:
+  struct Attempt {
+    size_t endpoint_index;
+    tcp::socket socket;
+    std::chrono::steady_clock::time_point start_time;
+  };
+
+  boost::asio::io_context& io_context_;
+  boost::asio::steady_timer delay_timer_;
+  std::vector<tcp::endpoint> endpoints_;
+  std::vector<size_t> order_;
+  size_t next_ = 0;
+  size_t running_ = 0;
+  bool finished_ = false;
+  std::vector<std::unique_ptr<Attempt>> attempts_;
+  std::vector<size_t> failed_endpoints_;
+  boost::system::error_code last_error_;
+  Handler handler_;
+
+  explicit ParallelConnector(boost::asio::io_context& io_context)
+      : io_context_(io_context), delay_timer_(io_context) {}
+  void StartNextAttempt();
+  void HandleConnect(Attempt& attempt, const boost::system::error_code& error);
+  void Finish(const boost::system::error_code& error, Attempt* winner);
+};
+
+}  // namespace dnstoy
+#endif  // DNSTOY_PARALLEL_CONNECTOR_H_
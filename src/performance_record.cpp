@@ -1,5 +1,7 @@
 #include "performance_record.hpp"
 
+#include <algorithm>
+
 #include "logging.hpp"
 
 namespace dnstoy {
@@ -22,10 +24,32 @@ void PerformanceRecord::record_and_decrease_load(
     sampled_count_++;
   }
   average_time_cost_ = time_cost_sum_ / sampled_count_;
+
+  percentile_record_[percentile_record_front_] = cost;
+  percentile_record_front_++;
+  percentile_record_front_ %= percentile_sample_count_;
+  if (percentile_sampled_count_ < percentile_sample_count_) {
+    percentile_sampled_count_++;
+  }
   load_--;
   estimate_delay();
 }
 
+std::chrono::milliseconds PerformanceRecord::percentile(
+    uint16_t percent) const {
+  if (percentile_sampled_count_ == 0) {
+    return std::chrono::milliseconds(0);
+  }
+  // samples fill the record from its front until it is full
+  auto samples = percentile_record_;
+  auto count = percentile_sampled_count_;
+  auto rank = (count * std::min<uint16_t>(percent, 100) + 99) / 100;
+  auto end = samples.begin() + count;
+  auto nth = samples.begin() + (rank ? rank - 1 : 0);
+  std::nth_element(samples.begin(), nth, end);
+  return *nth;
+}
+
 void PerformanceRecord::increase_load() {
   load_++;
   estimate_delay();
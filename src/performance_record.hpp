@@ -13,6 +13,12 @@ class PerformanceRecord {
   void increase_load();
   size_t load() { return load_; }
   size_t estimated_delay() { return estimated_delay_; }
+  // enough samples are taken for percentile to tell the tail of the server
+  bool warmed_up() const {
+    return percentile_sampled_count_ == percentile_sample_count_;
+  }
+  // nearest rank percentile of the recent time costs, 0 without samples
+  std::chrono::milliseconds percentile(uint16_t percent) const;
 
  private:
   // TODO: add sample_count to configuration
@@ -24,6 +30,13 @@ class PerformanceRecord {
   size_t estimated_delay_ = 0;
   std::chrono::milliseconds time_cost_sum_{0};
   std::chrono::milliseconds average_time_cost_{0};
+  // the latest sample_count_ costs hold one or two of a slow tail at best,
+  // percentiles are taken of a longer history
+  static constexpr size_t percentile_sample_count_ = 64;
+  std::array<std::chrono::milliseconds, percentile_sample_count_>
+      percentile_record_{};
+  size_t percentile_record_front_ = 0;
+  size_t percentile_sampled_count_ = 0;
 
   void estimate_delay();
 };
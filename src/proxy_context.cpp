@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <boost/endian/conversion.hpp>
 #include <chrono>
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include "proxy.hpp"
 #include "resolver.hpp"
+#include "shared_object_pool.hpp"
 
 namespace endian = boost::endian;
 using boost::asio::async_write;
@@ -19,8 +22,24 @@ using std::chrono::milliseconds;
 namespace dnstoy {
 namespace proxy {
 
+#if defined(DNSTOY_HAVE_IO_URING)
+namespace {
+// keeps a reply and its message header alive until io_uring completes it
+struct IoUringSendOperation {
+  msghdr header;
+  iovec buffer;
+  QueryContext::pointer query;
+  void on_recycled_by_object_pool() { query.reset(); }
+};
+using IoUringSendOperationPool = SharedObjectPool<IoUringSendOperation, 256>;
+}  // namespace
+#endif  // defined(DNSTOY_HAVE_IO_URING)
+
 void Context::Stop() {
   message_reader_.Stop();
+#if defined(DNSTOY_HAVE_IO_URING)
+  IoUring::get().Cancel(io_uring_receive_operation_);
+#endif  // defined(DNSTOY_HAVE_IO_URING)
   if (std::holds_alternative<boost::asio::ip::udp::socket>(socket_)) {
     error_code error;
     std::get<udp::socket>(socket_).close();
@@ -149,7 +168,23 @@ void Context::QueueReply(QueryContext::pointer&& query) {
 
   query->CancelExpireTimer();
   query->status = QueryContext::Status::ANSWER_ACCEPTED;
-  reply_queue_.emplace(std::move(query));
+  reply_queue_.emplace_back(std::move(query));
+#if defined(DNSTOY_HAVE_MMSG) || defined(DNSTOY_HAVE_IO_URING)
+  if ((udp_batch_size_ > 1 || use_io_uring_) &&
+      std::holds_alternative<boost::asio::ip::udp::socket>(socket_)) {
+    // flush once the current handlers are done, so replies produced in the
+    // same round of the event loop go out in one batch
+    if (!write_scheduled_) {
+      write_scheduled_ = true;
+      boost::asio::post(std::get<udp::socket>(socket_).get_executor(),
+                        [this, _ = shared_from_this()]() {
+                          write_scheduled_ = false;
+                          DoWrite();
+                        });
+    }
+    return;
+  }
+#endif  // defined(DNSTOY_HAVE_MMSG) || defined(DNSTOY_HAVE_IO_URING)
   DoWrite();
 }
 
@@ -160,9 +195,21 @@ void Context::DoWrite() {
   if (reply_queue_.empty()) {
     return;
   }
+#if defined(DNSTOY_HAVE_IO_URING)
+  if (use_io_uring_) {
+    DoWriteIoUring();
+    return;
+  }
+#endif  // defined(DNSTOY_HAVE_IO_URING)
+#if defined(DNSTOY_HAVE_MMSG)
+  if (udp_batch_size_ > 1 && std::holds_alternative<udp::socket>(socket_)) {
+    DoWriteUdpBatch();
+    return;
+  }
+#endif  // defined(DNSTOY_HAVE_MMSG)
   writing_ = true;
   auto query = std::move(reply_queue_.front());
-  reply_queue_.pop();
+  reply_queue_.pop_front();
 
   auto& endpoint = query->endpoint;
   auto write_data = query->raw_message.data();
@@ -196,6 +243,180 @@ void Context::DoWrite() {
   }
 }
 
-Context::~Context() { message_reader_.Stop(); }
+#if defined(DNSTOY_HAVE_MMSG)
+void Context::DoWriteUdpBatch() {
+  auto& socket = std::get<udp::socket>(socket_);
+  if (!socket.is_open()) {
+    return;
+  }
+  while (!reply_queue_.empty()) {
+    auto count = std::min(reply_queue_.size(), udp_batch_size_);
+    send_iovecs_.resize(count);
+    send_messages_.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      auto& query = *reply_queue_[i];
+      auto& endpoint = std::get<udp::endpoint>(query.endpoint);
+      send_iovecs_[i].iov_base =
+          query.raw_message.data() + offsetof(dns::RawTcpMessage, message);
+      send_iovecs_[i].iov_len =
+          query.raw_message.size() - offsetof(dns::RawTcpMessage, message);
+      auto& header = send_messages_[i].msg_hdr;
+      header = {};
+      header.msg_name = endpoint.data();
+      header.msg_namelen = endpoint.size();
+      header.msg_iov = &send_iovecs_[i];
+      header.msg_iovlen = 1;
+    }
+    auto sent = ::sendmmsg(socket.native_handle(), send_messages_.data(),
+                           count, MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        writing_ = true;
+        socket.async_wait(udp::socket::wait_write,
+                          [this, _ = shared_from_this()](error_code error) {
+                            writing_ = false;
+                            if (error) {
+                              LOG_TRACE(<< error.message());
+                              return;
+                            }
+                            DoWrite();
+                          });
+        return;
+      }
+      // sendmmsg reports the error of the first message, drop it and go on
+      LOG_ERROR(<< "send reply failed: " << strerror(errno));
+      sent = 1;
+    }
+    reply_queue_.erase(reply_queue_.begin(), reply_queue_.begin() + sent);
+  }
+}
+#endif  // defined(DNSTOY_HAVE_MMSG)
+
+#if defined(DNSTOY_HAVE_IO_URING)
+bool Context::StartIoUring() {
+  auto& io_uring = IoUring::get();
+  if (!io_uring.running()) {
+    return false;
+  }
+  // kernel writes io_uring_recvmsg_out, source address and then payload
+  auto buffer_size = sizeof(io_uring_recvmsg_out) +
+                     udp::endpoint().capacity() + message_reader_.buffer_size();
+  if (!io_uring.RegisterBufferRing(io_uring_buffers_,
+                                   std::max<size_t>(udp_batch_size_, 16),
+                                   buffer_size)) {
+    return false;
+  }
+  use_io_uring_ = true;
+  DoReadIoUring();
+  return true;
+}
+
+void Context::DoReadIoUring() {
+  auto& socket = std::get<udp::socket>(socket_);
+  if (!socket.is_open()) {
+    return;
+  }
+  io_uring_receive_header_ = {};
+  io_uring_receive_header_.msg_namelen = udp::endpoint().capacity();
+  io_uring_receive_operation_ = IoUring::get().RecvMsgMultishot(
+      socket.native_handle(), &io_uring_receive_header_, io_uring_buffers_,
+      [this, _ = shared_from_this()](int32_t result, uint32_t flags) {
+        HandleIoUringMessage(result, flags);
+      });
+}
+
+void Context::HandleIoUringMessage(int32_t result, uint32_t flags) {
+  if (result >= 0 && (flags & IORING_CQE_F_BUFFER)) {
+    uint16_t index = flags >> IORING_CQE_BUFFER_SHIFT;
+    auto buffer = io_uring_buffers_.buffer(index);
+    auto output = reinterpret_cast<const io_uring_recvmsg_out*>(buffer);
+    auto name = buffer + sizeof(io_uring_recvmsg_out);
+    auto payload = name + io_uring_receive_header_.msg_namelen +
+                   io_uring_receive_header_.msg_controllen;
+    if (output->flags & MSG_TRUNC) {
+      LOG_ERROR("udp message larger than " << message_reader_.buffer_size()
+                                            << " dropped");
+    } else if (output->namelen <= io_uring_receive_header_.msg_namelen) {
+      udp::endpoint endpoint;
+      memcpy(endpoint.data(), name, output->namelen);
+      endpoint.resize(output->namelen);
+      HandleUserMessage(MessageReader::Reason::NEW_MESSAGE, payload,
+                        output->payloadlen, &endpoint);
+    }
+    io_uring_buffers_.Recycle(index);
+  }
+  if (flags & IORING_CQE_F_MORE) {
+    return;
+  }
+  io_uring_receive_operation_ = 0;
+  if (result == -ECANCELED || !IoUring::get().running()) {
+    return;
+  }
+  auto& socket = std::get<udp::socket>(socket_);
+  if (result == -EINVAL) {
+    LOG_ERROR("multishot recvmsg is not supported by kernel, fall back to "
+              "asio");
+    use_io_uring_ = false;
+    auto handler = std::bind(&Context::HandleUserMessage, shared_from_this(),
+                             std::placeholders::_1, std::placeholders::_2,
+                             std::placeholders::_3, std::placeholders::_4);
+    message_reader_.Start(socket, handler);
+    return;
+  }
+  // ENOBUFS: ran out of provided buffers, they are recycled already
+  if (result < 0 && result != -ENOBUFS && result != -EINTR) {
+    // re-arming on a broken socket fails again right away, stop reading as
+    // the asio path does
+    LOG_ERROR(<< strerror(-result));
+    return;
+  }
+  DoReadIoUring();
+}
+
+void Context::DoWriteIoUring() {
+  auto& socket = std::get<udp::socket>(socket_);
+  if (!socket.is_open()) {
+    return;
+  }
+  auto& io_uring = IoUring::get();
+  while (!reply_queue_.empty()) {
+    auto operation = IoUringSendOperationPool::get().get_object();
+    operation->query = std::move(reply_queue_.front());
+    reply_queue_.pop_front();
+    auto& query = *operation->query;
+    auto& endpoint = std::get<udp::endpoint>(query.endpoint);
+    operation->buffer.iov_base =
+        query.raw_message.data() + offsetof(dns::RawTcpMessage, message);
+    operation->buffer.iov_len =
+        query.raw_message.size() - offsetof(dns::RawTcpMessage, message);
+    operation->header = {};
+    operation->header.msg_name = endpoint.data();
+    operation->header.msg_namelen = endpoint.size();
+    operation->header.msg_iov = &operation->buffer;
+    operation->header.msg_iovlen = 1;
+    auto header = &operation->header;
+    auto submitted = io_uring.SendMsg(
+        socket.native_handle(), header,
+        [operation = std::move(operation)](int32_t result, uint32_t) {
+          if (result < 0) {
+            LOG_ERROR("send reply failed: " << strerror(-result));
+          }
+        });
+    if (!submitted) {
+      LOG_ERROR("send reply failed: io_uring unavailable");
+    }
+  }
+}
+#endif  // defined(DNSTOY_HAVE_IO_URING)
+
+Context::~Context() {
+  message_reader_.Stop();
+#if defined(DNSTOY_HAVE_IO_URING)
+  IoUring::get().UnregisterBufferRing(io_uring_buffers_);
+#endif  // defined(DNSTOY_HAVE_IO_URING)
+}
 }  // namespace proxy
 }  // namespace dnstoy
\ No newline at end of file
@@ -4,11 +4,12 @@
 #include <boost/asio.hpp>
 #include <chrono>
 #include <functional>
+#include <deque>
 #include <memory>
-#include <queue>
 #include <vector>
 #include "configuration.hpp"
 #include "dns.hpp"
+#include "io_uring.hpp"
 #include "message_reader.hpp"
 #include "proxy.hpp"
 #include "query.hpp"
@@ -35,6 +36,13 @@ class Context : public std::enable_shared_from_this<Context> {
                                std::placeholders::_3, std::placeholders::_4);
       message_reader_.resize_buffer(
           Configuration::get("udp-paylad-size-limit").as<uint16_t>());
+      udp_batch_size_ = Configuration::get("udp-batch-size").as<uint16_t>();
+      message_reader_.resize_udp_batch(udp_batch_size_);
+#if defined(DNSTOY_HAVE_IO_URING)
+      if (StartIoUring()) {
+        return;
+      }
+#endif  // defined(DNSTOY_HAVE_IO_URING)
       message_reader_.Start(std::get<UdpSocketType>(socket_), handler);
     } else {
       auto handler = std::bind(&Context::HandleUserMessage, shared_from_this(),
@@ -52,8 +60,25 @@ class Context : public std::enable_shared_from_this<Context> {
                boost::asio::ip::udp::socket>
       socket_;
   MessageReader message_reader_;
-  std::queue<QueryContext::pointer> reply_queue_;
+  std::deque<QueryContext::pointer> reply_queue_;
   bool writing_ = false;
+  bool write_scheduled_ = false;
+  size_t udp_batch_size_ = 1;
+  bool use_io_uring_ = false;
+#if defined(DNSTOY_HAVE_MMSG)
+  std::vector<iovec> send_iovecs_;
+  std::vector<mmsghdr> send_messages_;
+  void DoWriteUdpBatch();
+#endif  // defined(DNSTOY_HAVE_MMSG)
+#if defined(DNSTOY_HAVE_IO_URING)
+  IoUring::BufferRing io_uring_buffers_;
+  msghdr io_uring_receive_header_{};
+  IoUring::OperationID io_uring_receive_operation_ = 0;
+  bool StartIoUring();
+  void DoReadIoUring();
+  void HandleIoUringMessage(int32_t result, uint32_t flags);
+  void DoWriteIoUring();
+#endif  // defined(DNSTOY_HAVE_IO_URING)
 
   Context() {}
   void ReplyFailure(QueryContext::pointer&& query);
@@ -13,13 +13,12 @@ void QueryManager::CutInQueryRecord(QueryRecord&& record) {
   query_queue_.emplace_front(std::move(record));
 }
 
-size_t QueryManager::QueueSize() { return query_queue_.size(); }
+size_t QueryManager::QueueSize() const { return query_queue_.size(); }
 
-bool QueryManager::GetRecord(QueryRecord& record, int16_t& id) {
+bool QueryManager::GetRecord(QueryRecord& record) {
   if (query_queue_.size()) {
     auto& current = query_queue_.front();
     record = std::move(current);
-    id = counter_++;
     query_queue_.pop_front();
     return true;
   }
@@ -53,6 +53,22 @@ class QueryContext : public std::enable_shared_from_this<QueryContext> {
 
   void CancelExpireTimer() { timer_.cancel(); }
 
+  // handler gets the query after duration if it still waits for an answer
+  template <typename DurationType, typename HandlerType>
+  void HedgeAfter(DurationType duration, HandlerType&& handler) {
+    hedge_timer_.expires_after(duration);
+    hedge_timer_.async_wait(
+        [self = shared_from_this(),
+         handler = std::forward<HandlerType>(handler)](
+            boost::system::error_code error) mutable {
+          if (!error && self->status == Status::WAITING_FOR_ANSWER) {
+            handler(self);
+          }
+        });
+  }
+
+  void CancelHedgeTimer() { hedge_timer_.cancel(); }
+
   void on_recycled_by_object_pool() {
     // endpoint = TcpEndpoint{};
     query.reset();
@@ -64,6 +80,7 @@ class QueryContext : public std::enable_shared_from_this<QueryContext> {
  private:
   QueryContext(){};
   boost::asio::steady_timer timer_{Engine::get().GetExecutor()};
+  boost::asio::steady_timer hedge_timer_{Engine::get().GetExecutor()};
 };
 
 using QueryContextPool = SharedObjectPool<
@@ -79,12 +96,11 @@ class QueryManager {
   using QueryRecord = std::pair<QueryContext::pointer, QueryResultHandler>;
   void QueueQuery(QueryContext::pointer& context, QueryResultHandler& handler);
   void CutInQueryRecord(QueryRecord&& record);
-  size_t QueueSize();
-  bool GetRecord(QueryRecord& record, int16_t& id);
+  size_t QueueSize() const;
+  bool GetRecord(QueryRecord& record);
 
  private:
   std::deque<QueryRecord> query_queue_;
-  int16_t counter_ = 0;
 };
 
 }  // namespace dnstoy
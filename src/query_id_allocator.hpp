@@ -0,0 +1,49 @@
+#ifndef DNSTOY_QUERY_ID_ALLOCATOR_H_
+#define DNSTOY_QUERY_ID_ALLOCATOR_H_
+
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace dnstoy {
+
+// Hands out the 16 bit IDs of queries sent on one upstream connection.
+// Free IDs are kept in an unordered list, Allocate swaps a random entry to
+// the back and pops it, so both allocation and release are O(1) and the next
+// ID can not be guessed from the previous ones (rfc5452 4.3).
+// thread-unsafe, designed for thread_local use
+class QueryIdAllocator {
+ public:
+  QueryIdAllocator() : random_engine_(std::random_device()()) {
+    free_ids_.reserve(id_count_);
+    for (size_t id = 0; id < id_count_; id++) {
+      free_ids_.push_back(static_cast<uint16_t>(id));
+    }
+  }
+
+  // no ID is left until one is released, callers should hold their queries
+  bool empty() const { return free_ids_.empty(); }
+  size_t in_use() const { return id_count_ - free_ids_.size(); }
+
+  uint16_t Allocate() {
+    std::uniform_int_distribution<size_t> distribution(0,
+                                                       free_ids_.size() - 1);
+    std::swap(free_ids_[distribution(random_engine_)], free_ids_.back());
+    auto id = free_ids_.back();
+    free_ids_.pop_back();
+    return id;
+  }
+
+  void Release(uint16_t id) { free_ids_.push_back(id); }
+
+ private:
+  static constexpr size_t id_count_ =
+      size_t(std::numeric_limits<uint16_t>::max()) + 1;
+  std::vector<uint16_t> free_ids_;
+  std::mt19937 random_engine_;
+};
+
+}  // namespace dnstoy
+#endif  // DNSTOY_QUERY_ID_ALLOCATOR_H_
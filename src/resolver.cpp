@@ -1,9 +1,11 @@
 #include "resolver.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <regex>
 #include <string>
 
+#include "cache.hpp"
 #include "configuration.hpp"
 #include "dns.hpp"
 #include "engine.hpp"
@@ -22,13 +24,53 @@ using std::chrono::steady_clock;
 namespace dnstoy {
 
 std::vector<Resolver::ServerConfiguration> Resolver::server_configurations_;
+ServerSelector::Strategy Resolver::server_selection_ =
+    ServerSelector::Strategy::P2C;
 thread_local std::vector<Resolver::ServerInstanceStore>
     Resolver::server_instances_;
-thread_local std::set<size_t, Resolver::ComparePerformanceRank>
-    Resolver::server_speed_ranking_;
-thread_local size_t Resolver::round_robin_for_idle = 0;
+thread_local ServerSelector Resolver::server_selector_;
+thread_local uint32_t Resolver::hedge_credit_ = 0;
+thread_local size_t Resolver::round_robin_for_probe_ = 0;
+thread_local std::unique_ptr<boost::asio::steady_timer>
+    Resolver::keep_warm_timer_;
+thread_local std::unordered_map<string, Resolver::InFlightQuery>
+    Resolver::in_flight_queries_;
 std::vector<uint8_t> Resolver::edns0_client_subnet_;
 
+Resolver::ServerConfiguration::Transport
+Resolver::ServerConfiguration::transport() const {
+  if (!tls_endpoints.empty()) {
+    return Transport::TLS;
+  }
+  if (!https_endpoints.empty()) {
+    return Transport::HTTPS;
+  }
+  if (!tcp_endpoints.empty()) {
+    return Transport::TCP;
+  }
+  return Transport::UDP;
+}
+
+string Resolver::ServerConfiguration::name() const {
+  if (!hostname.empty()) {
+    return hostname;
+  }
+  if (!tcp_endpoints.empty()) {
+    return tcp_endpoints.front().address().to_string();
+  }
+  if (!udp_endpoints.empty()) {
+    return udp_endpoints.front().address().to_string();
+  }
+  return hostname;
+}
+
+void Resolver::InitServerInstances() {
+  if (server_instances_.empty()) {
+    server_instances_.resize(server_configurations_.size());
+    server_selector_.reset(server_instances_.size(), server_selection_);
+  }
+}
+
 void Resolver::Resolve(QueryContext::pointer&& query,
                        QueryResultHandler&& handler) {
   if (Preprocess(query, handler)) {
@@ -36,67 +78,304 @@ void Resolver::Resolve(QueryContext::pointer&& query,
   }
 }
 
+namespace {
+// a client waits for remote servers while an expired answer is in cache
+struct StaleAnswerWaiter {
+  boost::asio::steady_timer timer{Engine::get().GetExecutor()};
+  // the client got the expired answer, the remote answer only refreshes cache
+  bool served = false;
+};
+}  // namespace
+
 bool Resolver::Preprocess(QueryContext::pointer& query,
-                          QueryResultHandler& /*handler*/) {
+                          QueryResultHandler& handler) {
+  string cache_key;
+  if (!Cache::MakeKey(query->query, cache_key)) {
+    AppendClientSubnet(*query);
+    return true;
+  }
+  auto& cache = Cache::get();
+  auto lookup_result = Cache::LookupResult::miss;
+  if (cache.enabled()) {
+    std::vector<uint8_t> refresh_query;
+    lookup_result = cache.Lookup(cache_key, *query, refresh_query);
+    if (lookup_result == Cache::LookupResult::hit ||
+        lookup_result == Cache::LookupResult::hit_and_refresh) {
+      if (lookup_result == Cache::LookupResult::hit_and_refresh) {
+        Prefetch(*query, std::move(cache_key), std::move(refresh_query));
+      }
+      query->status = QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER;
+      handler(std::move(query), boost::system::errc::make_error_code(
+                                    boost::system::errc::success));
+      return false;
+    }
+  }
+  auto stale = lookup_result == Cache::LookupResult::stale;
+  if (CoalesceQuery(cache_key, stale, query, handler)) {
+    return false;
+  }
+
+  if (cache.enabled()) {
+    handler = [cache_key = std::move(cache_key), handler = std::move(handler)](
+                  QueryContext::pointer&& context,
+                  boost::system::error_code error) {
+      if (context->status == QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER) {
+        Cache::get().Store(cache_key, context->raw_message);
+      }
+      handler(std::move(context), error);
+    };
+  }
+  AppendClientSubnet(*query);
+  return true;
+}
+
+void Resolver::WaitForStaleAnswer(const string& cache_key,
+                                  QueryContext::pointer& query,
+                                  QueryResultHandler& handler) {
+  static auto stale_answer_timeout_ = milliseconds(
+      Configuration::get("cache-stale-answer-timeout").as<uint32_t>());
+  auto stale_answer_waiter = std::make_shared<StaleAnswerWaiter>();
+  // no need to wait if no remote server can be connected now
+  stale_answer_waiter->timer.expires_after(
+      IsEveryServerRetryDelayed() ? milliseconds(0) : stale_answer_timeout_);
+  stale_answer_waiter->timer.async_wait(
+      [waiter = stale_answer_waiter, query, cache_key,
+       handler](boost::system::error_code error) {
+        if (error || waiter->served ||
+            query->status != QueryContext::Status::WAITING_FOR_ANSWER) {
+          return;
+        }
+        waiter->served = ServeStale(cache_key, *query, handler);
+      });
+  handler = [cache_key, handler = std::move(handler), stale_answer_waiter](
+                QueryContext::pointer&& context,
+                boost::system::error_code error) {
+    auto answered =
+        context->status == QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER;
+    auto& waiter = *stale_answer_waiter;
+    waiter.timer.cancel();
+    if (!waiter.served && !answered) {
+      // remote servers failed, expired answer is better than SERVFAIL
+      waiter.served = ServeStale(cache_key, *context, handler);
+    }
+    if (waiter.served) {
+      if (answered) {
+        context->CancelExpireTimer();
+        context->status = QueryContext::Status::ANSWER_ACCEPTED;
+      }
+      return;
+    }
+    handler(std::move(context), error);
+  };
+}
+
+bool Resolver::CoalesceQuery(const string& key, bool stale,
+                             QueryContext::pointer& query,
+                             QueryResultHandler& handler) {
+  auto i = in_flight_queries_.find(key);
+  // a leader expired while its remote resolve stalls may not finish for long
+  if (i != in_flight_queries_.end() &&
+      i->second.leader->status == QueryContext::Status::WAITING_FOR_ANSWER) {
+    auto& in_flight_query = i->second;
+    // a udp client retransmits with the same ID, it gets the answer once
+    auto is_retransmission = [&query](const QueryContext& other) {
+      return std::holds_alternative<QueryContext::UdpEndpoint>(
+                 query->endpoint) &&
+             other.query.header.id == query->query.header.id &&
+             other.endpoint == query->endpoint;
+    };
+    if (is_retransmission(*in_flight_query.leader) ||
+        std::any_of(in_flight_query.waiters.begin(),
+                    in_flight_query.waiters.end(),
+                    [&is_retransmission](const QueryManager::QueryRecord& r) {
+                      return is_retransmission(*r.first);
+                    })) {
+      LOG_DEBUG("ID:" << query->query.header.id << " retransmission dropped");
+      return true;
+    }
+    // every waiter gets the expired answer in time, even behind a leader
+    // that came earlier
+    if (stale) {
+      WaitForStaleAnswer(key, query, handler);
+    }
+    in_flight_query.waiters.emplace_back(std::move(query), std::move(handler));
+    return true;
+  }
+
+  // query takes over from an expired leader, whose waiters stay to get the
+  // answer of query
+  in_flight_queries_[key].leader = query;
+  if (stale) {
+    WaitForStaleAnswer(key, query, handler);
+  }
+  handler = [key, leader = query.get(), handler = std::move(handler)](
+                QueryContext::pointer&& context,
+                boost::system::error_code error) {
+    auto i = in_flight_queries_.find(key);
+    // a later query of the same key may be in flight after this one finished
+    if (i != in_flight_queries_.end() && i->second.leader.get() == leader) {
+      auto waiters = std::move(i->second.waiters);
+      in_flight_queries_.erase(i);
+      // answer waiters first, the leader's answer buffer is sent in place
+      for (auto& waiter : waiters) {
+        AnswerWaiter(*context, waiter, error);
+      }
+    }
+    handler(std::move(context), error);
+  };
+  return false;
+}
+
+void Resolver::AnswerWaiter(const QueryContext& context,
+                            QueryManager::QueryRecord& waiter,
+                            boost::system::error_code error) {
+  auto& query = waiter.first;
+  if (context.status == QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER &&
+      query->status == QueryContext::Status::WAITING_FOR_ANSWER) {
+    auto& buffer = query->raw_message;
+    buffer = context.raw_message;
+    dns::MessageEncoder::RewriteIDToTcpMessage(buffer.data(), buffer.size(),
+                                               query->query.header.id);
+    dns::MessageEncoder::RewriteQuestionNameCaseToTcpMessage(
+        buffer.data(), buffer.size(), query->query.questions.front().name);
+    query->status = QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER;
+  }
+  waiter.second(std::move(query), error);
+}
+
+bool Resolver::ServeStale(const string& cache_key, const QueryContext& query,
+                          const QueryResultHandler& handler) {
+  // the original query stays with remote servers to refresh the cache
+  auto stale_query = QueryContextPool::get().get_object();
+  stale_query->endpoint = query.endpoint;
+  stale_query->query = query.query;
+  if (!Cache::get().LookupStale(cache_key, *stale_query)) {
+    return false;
+  }
+  LOG_DEBUG(<< query.query.questions.front().name << " served stale");
+  stale_query->status = QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER;
+  handler(std::move(stale_query), boost::system::errc::make_error_code(
+                                      boost::system::errc::success));
+  return true;
+}
+
+bool Resolver::IsEveryServerRetryDelayed() {
+  if (server_instances_.empty()) {
+    return false;
+  }
+  for (auto& server : server_instances_) {
+    if (server.https_resolver) {
+      if (!server.https_resolver->retry_delayed()) {
+        return false;
+      }
+      continue;
+    }
+    if (server.tls_resolvers.empty()) {
+      return false;
+    }
+    for (auto& tls_resolver : server.tls_resolvers) {
+      if (!tls_resolver->retry_delayed()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void Resolver::AppendClientSubnet(QueryContext& query) {
   if (edns0_client_subnet_.size() &&
-      !dns::MessageDecoder::IsMessageContainsEDNS(query->query)) {
+      !dns::MessageDecoder::IsMessageContainsEDNS(query.query)) {
     dns::MessageEncoder::AppendAdditionalResourceRecordToRawTcpMessage(
-        query->raw_message, edns0_client_subnet_.data(),
+        query.raw_message, edns0_client_subnet_.data(),
         edns0_client_subnet_.size());
   }
-  return true;
+}
+
+void Resolver::Prefetch(const QueryContext& query, string&& cache_key,
+                        std::vector<uint8_t>&& raw_query) {
+  static auto query_timeout_ =
+      milliseconds(Configuration::get("query-timeout").as<uint32_t>());
+  LOG_DEBUG(<< query.query.questions.front().name << " prefetch");
+  auto prefetch_query = QueryContextPool::get().get_object();
+  prefetch_query->query = query.query;
+  prefetch_query->raw_message = std::move(raw_query);
+  AppendClientSubnet(*prefetch_query);
+  prefetch_query->ExpiresAfter(query_timeout_);
+  // nobody waits for the answer, it only replaces the cache entry
+  QueryResultHandler handler = [cache_key = std::move(cache_key)](
+                                   QueryContext::pointer&& context,
+                                   boost::system::error_code /*error*/) {
+    if (context->status == QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER) {
+      context->CancelExpireTimer();
+      context->status = QueryContext::Status::ANSWER_ACCEPTED;
+      Cache::get().Store(cache_key, context->raw_message);
+    }
+  };
+  Dispatch(prefetch_query, handler);
 }
 
 void Resolver::Dispatch(QueryContext::pointer& query,
                         QueryResultHandler& handler) {
-  // TODO: select server & resolver by rule
-  if (server_instances_.empty()) {
-    server_instances_.resize(server_configurations_.size());
-    for (size_t i = 0; i < server_instances_.size(); i++) {
-      server_speed_ranking_.insert(i);
-    }
-  }
+  static auto hedge_percentile_ =
+      Configuration::get("hedge-percentile").as<uint16_t>();
+  static uint32_t hedge_budget_ =
+      Configuration::get("hedge-budget").as<uint16_t>();
+  InitServerInstances();
 
-  auto fast_server_index = *server_speed_ranking_.begin();
-  ResolveQueryWithServer(fast_server_index, query, handler);
+  hedge_credit_ = std::min(hedge_credit_ + hedge_budget_, hedge_credit_limit_);
+  auto server_index = server_selector_.Select();
+  auto& record = server_selector_.record(server_index);
+  auto warmed_up = record.warmed_up();
+  // a server answering within a millisecond is not worth a hedge timer
+  auto hedge_delay =
+      std::max(record.percentile(hedge_percentile_), milliseconds(1));
+  ResolveQueryWithServer(server_index, query, handler);
   if (server_instances_.size() < 2) {
     return;
   }
-  // round robin for idle gives an oppotunity to low ranking server to prove
-  // its performance when idle, as a public server may performances bad when
-  // busy but performances good when idle
-  round_robin_for_idle++;
-  round_robin_for_idle %= server_instances_.size();
-  if (round_robin_for_idle == fast_server_index) {
-    round_robin_for_idle++;
-    round_robin_for_idle %= server_instances_.size();
-  }
-  auto idle_server_index = round_robin_for_idle;
-  if (server_instances_[idle_server_index].performance_record.load() > 3) {
-    // not idle
+  if (!warmed_up) {
+    // too few samples to tell a slow answer from a usual one, race another
+    // server, which gets samples of its own this way too
+    ResolveQueryWithServer(server_selector_.SelectExcept(server_index), query,
+                           handler);
+    return;
+  }
+  if (hedge_credit_ < hedge_cost_) {
     return;
   }
-  ResolveQueryWithServer(idle_server_index, query, handler);
+  if (hedge_credit_ == hedge_credit_limit_) {
+    // no hedge was needed for a while, the budget goes to round robin, which
+    // gives servers seldom picked an opportunity to prove their performance,
+    // as a public server may perform bad when busy but good when idle
+    hedge_credit_ -= hedge_cost_;
+    round_robin_for_probe_++;
+    round_robin_for_probe_ %= server_instances_.size();
+    if (round_robin_for_probe_ == server_index) {
+      round_robin_for_probe_++;
+      round_robin_for_probe_ %= server_instances_.size();
+    }
+    ResolveQueryWithServer(round_robin_for_probe_, query, handler);
+    return;
+  }
+  query->HedgeAfter(hedge_delay, [server_index, handler](
+                                     QueryContext::pointer& context) mutable {
+    // others may have spent the budget meanwhile
+    if (hedge_credit_ < hedge_cost_) {
+      return;
+    }
+    hedge_credit_ -= hedge_cost_;
+    auto hedge_server_index = server_selector_.SelectExcept(server_index);
+    LOG_DEBUG(<< context->query.questions.front().name << " hedged to "
+              << server_configurations_[hedge_server_index].name());
+    ResolveQueryWithServer(hedge_server_index, context, handler);
+  });
 }
 
 void Resolver::ResolveQueryWithServer(size_t server_index,
                                       QueryContext::pointer& query,
                                       QueryResultHandler& handler) {
   query->pending_resolve_attempt++;
-  auto& server = server_instances_[server_index];
-  {
-    // update server load and rank
-    auto handle = server_speed_ranking_.extract(server_index);
-    server.performance_record.increase_load();
-    server_speed_ranking_.insert(std::move(handle));
-  }
-  auto& tls_resolver = server.tls_resolver;
-  if (!tls_resolver) {
-    tls_resolver = std::make_unique<TlsResolver>(
-        server_configurations_[server_index].hostname,
-        server_configurations_[server_index].tls_endpoints);
-  }
-
+  server_selector_.record(server_index).increase_load();
   QueryResultHandler new_handler = [server_index, handler,
                                     begin_time = steady_clock::now()](
                                        QueryContext::pointer&& context,
@@ -107,6 +386,7 @@ void Resolver::ResolveQueryWithServer(size_t server_index,
     if (context_status == QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER ||
         (context->pending_resolve_attempt == 0 &&
          context_status != QueryContext::Status::ANSWER_ACCEPTED)) {
+      context->CancelHedgeTimer();
       handler(std::move(context), error);
     }
     auto time_cost =
@@ -116,16 +396,164 @@ void Resolver::ResolveQueryWithServer(size_t server_index,
       // TODO: figure out a better factor
       time_cost *= 1.5;
     }
-    auto handle = server_speed_ranking_.extract(server_index);
     // TODO: take handshake into consideration
-    server_instances_[server_index].performance_record.record_and_decrease_load(
-        time_cost);
-    server_speed_ranking_.insert(std::move(handle));
+    server_selector_.record(server_index).record_and_decrease_load(time_cost);
   };
-  tls_resolver->Resolve(query, new_handler);
+  using Transport = ServerConfiguration::Transport;
+  switch (server_configurations_[server_index].transport()) {
+    case Transport::TLS:
+    case Transport::TCP:
+      SelectTlsResolver(server_index).Resolve(query, new_handler);
+      break;
+    case Transport::HTTPS:
+      GetHttpsResolver(server_index).Resolve(query, new_handler);
+      break;
+    case Transport::UDP:
+      GetUdpResolver(server_index).Resolve(query, new_handler);
+      break;
+  }
+}
+
+std::vector<std::unique_ptr<TlsResolver>>& Resolver::TlsResolverPool(
+    size_t server_index) {
+  auto& pool = server_instances_[server_index].tls_resolvers;
+  if (pool.empty()) {
+    static auto pool_size_ = std::max<uint16_t>(
+        1, Configuration::get("connections-per-server").as<uint16_t>());
+    auto& configuration = server_configurations_[server_index];
+    auto tls = !configuration.tls_endpoints.empty();
+    for (size_t i = 0; i < pool_size_; i++) {
+      // the hostname of tls servers is verified against their certificates
+      pool.emplace_back(std::make_unique<TlsResolver>(
+          tls ? configuration.hostname : configuration.name(),
+          tls ? configuration.tls_endpoints : configuration.tcp_endpoints,
+          tls));
+    }
+  }
+  return pool;
+}
+
+TlsResolver& Resolver::SelectTlsResolver(size_t server_index) {
+  auto& pool = TlsResolverPool(server_index);
+  // prefer connected ones, then the one with least outstanding queries
+  TlsResolver* selected = nullptr;
+  for (auto& tls_resolver : pool) {
+    // keeps spare connections ready, so a reset one does not stall the
+    // server, connections in reconnect backoff are left alone
+    tls_resolver->Warm();
+    if (!selected || (tls_resolver->ready() && !selected->ready()) ||
+        (tls_resolver->ready() == selected->ready() &&
+         tls_resolver->outstanding_queries() <
+             selected->outstanding_queries())) {
+      selected = tls_resolver.get();
+    }
+  }
+  return *selected;
+}
+
+UdpResolver& Resolver::GetUdpResolver(size_t server_index) {
+  auto& udp_resolver = server_instances_[server_index].udp_resolver;
+  if (!udp_resolver) {
+    auto& configuration = server_configurations_[server_index];
+    udp_resolver = std::make_unique<UdpResolver>(configuration.name(),
+                                                 configuration.udp_endpoints);
+  }
+  return *udp_resolver;
+}
+
+HttpsResolver& Resolver::GetHttpsResolver(size_t server_index) {
+  auto& https_resolver = server_instances_[server_index].https_resolver;
+  if (!https_resolver) {
+    auto& configuration = server_configurations_[server_index];
+    https_resolver = std::make_unique<HttpsResolver>(
+        configuration.hostname, configuration.https_path,
+        configuration.https_endpoints);
+  }
+  return *https_resolver;
+}
+
+void Resolver::Start() {
+  auto keep_warm_servers =
+      Configuration::get("keep-warm-servers").as<uint16_t>();
+  if (!keep_warm_servers) {
+    return;
+  }
+  InitServerInstances();
+  keep_warm_timer_ =
+      std::make_unique<boost::asio::steady_timer>(Engine::get().GetExecutor());
+  KeepWarm();
+}
+
+void Resolver::KeepWarm() {
+  static auto keep_warm_servers =
+      Configuration::get("keep-warm-servers").as<uint16_t>();
+  static auto interval = std::chrono::seconds(
+      Configuration::get("keep-warm-interval").as<uint32_t>());
+  size_t rank = 0;
+  for (auto server_index : server_selector_.Ranking()) {
+    auto keep_warm = rank++ < keep_warm_servers;
+    using Transport = ServerConfiguration::Transport;
+    auto transport = server_configurations_[server_index].transport();
+    if (transport == Transport::UDP) {
+      // nothing to keep warm over udp
+      continue;
+    }
+    if (transport == Transport::HTTPS) {
+      if (keep_warm || server_instances_[server_index].https_resolver) {
+        GetHttpsResolver(server_index).set_keep_warm(keep_warm);
+      }
+      continue;
+    }
+    auto& pool = keep_warm ? TlsResolverPool(server_index)
+                           : server_instances_[server_index].tls_resolvers;
+    for (auto& tls_resolver : pool) {
+      tls_resolver->set_keep_warm(keep_warm);
+    }
+  }
+  // a server falling behind in ranking is left to close on idle
+  keep_warm_timer_->expires_after(interval);
+  keep_warm_timer_->async_wait([](boost::system::error_code error) {
+    if (!error) {
+      KeepWarm();
+    }
+  });
+}
+
+void Resolver::Stop() {
+  if (keep_warm_timer_) {
+    keep_warm_timer_->cancel();
+  }
+  for (auto& server : server_instances_) {
+    for (auto& tls_resolver : server.tls_resolvers) {
+      tls_resolver->Close();
+    }
+    if (server.udp_resolver) {
+      server.udp_resolver->Close();
+    }
+    if (server.https_resolver) {
+      server.https_resolver->Close();
+    }
+  }
 }
 
 int Resolver::init() {
+  auto server_selection = Configuration::get("server-selection").as<string>();
+  if (!ServerSelector::ParseStrategy(server_selection, server_selection_)) {
+    LOG_ERROR("unknown server-selection " << server_selection);
+    return -1;
+  }
+  auto ca_file = Configuration::get("tls-ca-file").as<string>();
+  if (!ca_file.empty()) {
+    // the resolvers load it again into their own contexts
+    ssl::context context(ssl::context::tls_client);
+    boost::system::error_code error;
+    context.load_verify_file(ca_file, error);
+    if (error) {
+      LOG_ERROR("can not load tls-ca-file " << ca_file << ": "
+                                            << error.message());
+      return -1;
+    }
+  }
   auto result = LoadRemoteServers();
   if (result != 0) {
     return result;
@@ -146,6 +574,9 @@ int Resolver::LoadRemoteServers() {
   while (entry != regex_token_end) {
     std::vector<string_view> addresses;
     uint16_t tls_port_number = 0;
+    uint16_t https_port_number = 0;
+    uint16_t tcp_port_number = 0;
+    uint16_t udp_port_number = 0;
     ServerConfiguration server;
 
     regex_token_iterator option(entry->first, entry->second, options_regex,
@@ -161,21 +592,36 @@ int Resolver::LoadRemoteServers() {
                                          sub_option_regex);
           while (transport != regex_token_end) {
             auto transport_str = transport->str();
-            if (transport_str == "tls") {
-              tls_port_number = 853;
-            } else if (transport_str.compare(0, 4, "tls@") == 0) {
-              auto port_number = std::stoi(transport_str.substr(4));
+            auto port_position = transport_str.find('@');
+            auto transport_type = transport_str.substr(0, port_position);
+            uint16_t* port_number_pointer;
+            int port_number;
+            if (transport_type == "tls") {
+              port_number_pointer = &tls_port_number;
+              port_number = 853;
+            } else if (transport_type == "https") {
+              port_number_pointer = &https_port_number;
+              port_number = 443;
+            } else if (transport_type == "tcp") {
+              port_number_pointer = &tcp_port_number;
+              port_number = 53;
+            } else if (transport_type == "udp") {
+              port_number_pointer = &udp_port_number;
+              port_number = 53;
+            } else {
+              LOG_ERROR(<< "unknown transport type: " << transport_str
+                        << " check " << *entry);
+              return -1;
+            }
+            if (port_position != string::npos) {
+              port_number = std::stoi(transport_str.substr(port_position + 1));
               if (port_number <= 0 ||
                   port_number > std::numeric_limits<uint16_t>::max()) {
                 LOG_ERROR(<< *entry << " invalid port number " << port_number);
                 return -1;
               }
-              tls_port_number = port_number;
-            } else {
-              LOG_ERROR(<< "unknown transport type: " << transport_str
-                        << " check " << *entry);
-              return -1;
             }
+            *port_number_pointer = port_number;
             ++transport;
           }
         } break;
@@ -192,11 +638,10 @@ int Resolver::LoadRemoteServers() {
           // hostname
           server.hostname = option->str();
         } break;
-        default:
-          assert(false);
-          LOG_ERROR("Error on parsing config: " << *entry);
-          return -1;
-          break;
+        default: {
+          // the path of the https URI, segment by segment
+          server.https_path += "/" + option->str();
+        } break;
       }
     }
 
@@ -215,25 +660,61 @@ int Resolver::LoadRemoteServers() {
         LOG_INFO(<< server.hostname
                  << " resolve result:" << endpoint.address());
         if (tls_port_number) {
-          server.tls_endpoints.emplace_back(std::move(endpoint))
-              .port(tls_port_number);
+          server.tls_endpoints.emplace_back(endpoint).port(tls_port_number);
+        }
+        if (https_port_number) {
+          server.https_endpoints.emplace_back(endpoint).port(
+              https_port_number);
+        }
+        if (tcp_port_number) {
+          server.tcp_endpoints.emplace_back(endpoint).port(tcp_port_number);
+        }
+        if (udp_port_number) {
+          server.udp_endpoints.emplace_back(endpoint.address(),
+                                            udp_port_number);
         }
       }
 
     } else {
       // use user specified address
-      if (tls_port_number) {
-        for (auto& address : addresses) {
+      for (auto& address : addresses) {
+        if (tls_port_number) {
           server.tls_endpoints.emplace_back(
               tcp::endpoint(make_address(address), tls_port_number));
         }
+        if (https_port_number) {
+          server.https_endpoints.emplace_back(make_address(address),
+                                              https_port_number);
+        }
+        if (tcp_port_number) {
+          server.tcp_endpoints.emplace_back(make_address(address),
+                                            tcp_port_number);
+        }
+        if (udp_port_number) {
+          server.udp_endpoints.emplace_back(make_address(address),
+                                            udp_port_number);
+        }
       }
     }
 
-    if (!tls_port_number /* && !xxx_port_number*/) {
+    if (!tls_port_number && !https_port_number && !tcp_port_number &&
+        !udp_port_number) {
       LOG_ERROR(<< *entry << "no available transport found");
       return -1;
     }
+    if (https_port_number && server.hostname.empty()) {
+      // the :authority of every request
+      LOG_ERROR(<< *entry << " https needs a hostname");
+      return -1;
+    }
+    if (!https_port_number && !server.https_path.empty()) {
+      LOG_ERROR(<< *entry << " a path is for https only");
+      return -1;
+    }
+    if (server.https_path.empty()) {
+      // rfc8484 6: the path of the URI template of most servers
+      server.https_path = "/dns-query";
+    }
     server_configurations_.emplace_back(std::move(server));
     ++entry;
   }
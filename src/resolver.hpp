@@ -1,14 +1,17 @@
 #ifndef DNSTOY_RESOLVER_H_
 #define DNSTOY_RESOLVER_H_
 
-#include <set>
+#include <boost/asio/steady_timer.hpp>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
-#include "performance_record.hpp"
+#include "https_resolver.hpp"
 #include "query.hpp"
+#include "server_selector.hpp"
 #include "tls_resolver.hpp"
+#include "udp_resolver.hpp"
 
 namespace dnstoy {
 
@@ -19,43 +22,102 @@ class Resolver {
   static int init();
   static void Resolve(QueryContext::pointer&& query,
                       QueryResultHandler&& handler);
+  // starts the remote server connections of this thread kept warm by
+  // keep-warm-servers
+  static void Start();
+  // closes the remote server connections of this thread so its io_context
+  // can run out on stop
+  static void Stop();
 
  private:
   struct ServerConfiguration {
     std::string hostname;
+    // of the https URI, the request path
+    std::string https_path;
     std::vector<boost::asio::ip::tcp::endpoint> tls_endpoints;
-    // std::vector<boost::asio::ip::tcp::endpoint> https_endpoints;
-    // std::vector<boost::asio::ip::tcp::endpoint> tcp_endpoints;
-    // std::vector<boost::asio::ip::udp::endpoint> udp_endpoints;
-  };
+    std::vector<boost::asio::ip::tcp::endpoint> https_endpoints;
+    std::vector<boost::asio::ip::tcp::endpoint> tcp_endpoints;
+    std::vector<boost::asio::ip::udp::endpoint> udp_endpoints;
 
-  struct ServerInstanceStore {
-    std::unique_ptr<TlsResolver> tls_resolver;
-    PerformanceRecord performance_record;
+    enum class Transport { TLS, HTTPS, TCP, UDP };
+    // transports are preferred in the order tls, https, tcp, udp. tls and
+    // tcp servers are queried by the TlsResolver pool
+    Transport transport() const;
+    // hostname or the first address for logs
+    std::string name() const;
   };
 
-  struct ComparePerformanceRank {
-    bool operator()(size_t a, size_t b) const {
-      if (server_instances_[a].performance_record.estimated_delay() !=
-          server_instances_[b].performance_record.estimated_delay()) {
-        return server_instances_[a].performance_record.estimated_delay() <
-               server_instances_[b].performance_record.estimated_delay();
-      }
-      return a < b;
-    }
+  struct ServerInstanceStore {
+    // connections-per-server connections, each reconnects on its own,
+    // plain tcp ones for tcp servers
+    std::vector<std::unique_ptr<TlsResolver>> tls_resolvers;
+    // shared by all queries to the server, created on first use
+    std::unique_ptr<UdpResolver> udp_resolver;
+    // HTTP/2 multiplexes every query on one connection, created on first use
+    std::unique_ptr<HttpsResolver> https_resolver;
   };
 
   static std::vector<ServerConfiguration> server_configurations_;
+  static ServerSelector::Strategy server_selection_;
   static thread_local std::vector<ServerInstanceStore> server_instances_;
-  static thread_local std::set<size_t, ComparePerformanceRank>
-      server_speed_ranking_;
-  static thread_local size_t round_robin_for_idle;
+  // performance records of the servers, indexed like server_instances_
+  static thread_local ServerSelector server_selector_;
+  // hedge-budget percent of every dispatched query, a hedge costs
+  // hedge_cost_, the limit caps a burst of hedges after a quiet period
+  static constexpr uint32_t hedge_cost_ = 100;
+  static constexpr uint32_t hedge_credit_limit_ = 10 * hedge_cost_;
+  static thread_local uint32_t hedge_credit_;
+  // budget left unspent by hedges probes the servers in turn
+  static thread_local size_t round_robin_for_probe_;
+  // re-ranks the servers kept warm every keep-warm-interval
+  static thread_local std::unique_ptr<boost::asio::steady_timer>
+      keep_warm_timer_;
+  // identical queries waiting for the answer of the leader's remote resolve
+  struct InFlightQuery {
+    QueryContext::pointer leader;
+    std::vector<QueryManager::QueryRecord> waiters;
+  };
+  static thread_local std::unordered_map<std::string, InFlightQuery>
+      in_flight_queries_;
   static std::vector<uint8_t> edns0_client_subnet_;
 
   static bool Preprocess(QueryContext::pointer& query,
                          QueryResultHandler& handler);
+  // sends query to the server picked by server-selection, and to another one
+  // too when the first is cold or has not answered within its recent
+  // hedge-percentile, or to one in turn at once when the budget is not needed
   static void Dispatch(QueryContext::pointer& query,
                        QueryResultHandler& handler);
+  // returns true if query joins an identical in flight query, otherwise
+  // query becomes the leader and handler is wrapped to answer the waiters.
+  // stale: an expired answer of key is in cache, served to query if remote
+  // servers do not answer in time
+  static bool CoalesceQuery(const std::string& key, bool stale,
+                            QueryContext::pointer& query,
+                            QueryResultHandler& handler);
+  // handler is wrapped to serve the expired answer of cache_key once, after
+  // cache-stale-answer-timeout or on failure of remote servers
+  static void WaitForStaleAnswer(const std::string& cache_key,
+                                 QueryContext::pointer& query,
+                                 QueryResultHandler& handler);
+  static void AnswerWaiter(const QueryContext& context,
+                           QueryManager::QueryRecord& waiter,
+                           boost::system::error_code error);
+  static bool ServeStale(const std::string& cache_key,
+                         const QueryContext& query,
+                         const QueryResultHandler& handler);
+  static bool IsEveryServerRetryDelayed();
+  static void AppendClientSubnet(QueryContext& query);
+  static void Prefetch(const QueryContext& query, std::string&& cache_key,
+                       std::vector<uint8_t>&& raw_query);
+  static void InitServerInstances();
+  static std::vector<std::unique_ptr<TlsResolver>>& TlsResolverPool(
+      size_t server_index);
+  static TlsResolver& SelectTlsResolver(size_t server_index);
+  static UdpResolver& GetUdpResolver(size_t server_index);
+  static HttpsResolver& GetHttpsResolver(size_t server_index);
+  // keeps the connections of the keep-warm-servers fastest servers warm
+  static void KeepWarm();
   static void ResolveQueryWithServer(size_t server_index,
                                      QueryContext::pointer& query,
                                      QueryResultHandler& handler);
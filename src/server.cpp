@@ -1,4 +1,5 @@
 #include "server.hpp"
+#include <unistd.h>
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
@@ -6,11 +7,13 @@
 #include <csignal>
 #include <iostream>
 #include <string>
+#include "cache.hpp"
 #include "configuration.hpp"
 #include "engine.hpp"
 #include "logging.hpp"
 #include "proxy.hpp"
 #include "query.hpp"
+#include "resolver.hpp"
 
 using boost::asio::signal_set;
 using boost::asio::ip::make_address;
@@ -24,15 +27,37 @@ using std::string;
 using std::chrono::milliseconds;
 namespace dnstoy {
 
+#if defined(SO_REUSEPORT)
+// let every worker thread bind its own listener on the same address, the
+// kernel balances incoming datagrams and connections among them
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET,
+                                                               SO_REUSEPORT>;
+#endif  // defined(SO_REUSEPORT)
+
 Server::Server()
     : io_context_(Engine::get().GetExecutor()),
       tcp_socket_(io_context_),
       acceptor_(io_context_),
       signals_(io_context_),
+      statistics_signals_(io_context_),
       listen_address_(
           make_address(Configuration::get("listen-address").as<string>())),
       listen_port_(Configuration::get("listen-port").as<uint16_t>()),
-      stop_(false) {}
+      stop_(false) {
+  auto io_backend = Configuration::get("io-backend").as<string>();
+  if (io_backend == "io_uring") {
+#if defined(DNSTOY_HAVE_IO_URING)
+    use_io_uring_ = IoUring::get().Start(256);
+    if (!use_io_uring_) {
+      LOG_ERROR("io_uring is not available, fall back to asio");
+    }
+#else
+    LOG_ERROR("io_uring is not supported on this platform, fall back to asio");
+#endif  // defined(DNSTOY_HAVE_IO_URING)
+  } else if (io_backend != "asio") {
+    LOG_ERROR("unknown io-backend " << io_backend << ", fall back to asio");
+  }
+}
 
 void Server::Run() {
   signals_.add(SIGINT);
@@ -42,6 +67,12 @@ void Server::Run() {
 #endif  // defined(SIGQUIT)
 
   DoAwaitStop();
+#if defined(SIGUSR1)
+  // kill -USR1 makes every worker log its statistics
+  statistics_signals_.add(SIGUSR1);
+  DoAwaitStatisticsRequest();
+#endif  // defined(SIGUSR1)
+  Resolver::Start();
   io_context_.run();
 }
 
@@ -49,6 +80,9 @@ void Server::StartUdp() {
   auto udp_endpoint = udp::endpoint(listen_address_, listen_port_);
   udp::socket socket(io_context_);
   socket.open(udp_endpoint.protocol());
+#if defined(SO_REUSEPORT)
+  socket.set_option(reuse_port(true));
+#endif  // defined(SO_REUSEPORT)
   socket.bind(udp_endpoint);
   LOG_INFO("Listening on " << listen_address_ << ":" << listen_port_ << " UDP");
   auto udp_context = proxy::Context::create();
@@ -60,6 +94,9 @@ void Server::StartTcp() {
   auto tcp_endpoint = tcp::endpoint(listen_address_, listen_port_);
   acceptor_.open(tcp_endpoint.protocol());
   acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+#if defined(SO_REUSEPORT)
+  acceptor_.set_option(reuse_port(true));
+#endif  // defined(SO_REUSEPORT)
   acceptor_.bind(tcp_endpoint);
   acceptor_.listen();
   DoAccept();
@@ -67,6 +104,12 @@ void Server::StartTcp() {
 }
 
 void Server::DoAccept() {
+#if defined(DNSTOY_HAVE_IO_URING)
+  if (use_io_uring_) {
+    DoAcceptIoUring();
+    return;
+  }
+#endif  // defined(DNSTOY_HAVE_IO_URING)
   acceptor_.async_accept([this](error_code error, tcp::socket socket) {
     if (stop_) {
       return;
@@ -80,18 +123,92 @@ void Server::DoAccept() {
   });
 }
 
+#if defined(DNSTOY_HAVE_IO_URING)
+void Server::DoAcceptIoUring() {
+  // one multishot accept keeps producing connections until it is cancelled
+  accept_operation_ = IoUring::get().AcceptMultishot(
+      acceptor_.native_handle(), [this](int32_t result, uint32_t flags) {
+        if (result >= 0) {
+          error_code error;
+          tcp::socket socket(io_context_);
+          if (!stop_) {
+            socket.assign(acceptor_.local_endpoint(error).protocol(), result,
+                          error);
+          }
+          if (stop_ || error) {
+            close(result);
+          } else {
+            auto proxy_context = proxy::Context::create();
+            proxy_context->Start(std::move(socket));
+          }
+        }
+        if (flags & IORING_CQE_F_MORE) {
+          return;
+        }
+        accept_operation_ = 0;
+        if (stop_ || result == -ECANCELED) {
+          return;
+        }
+        if (result == -EINVAL) {
+          LOG_ERROR("multishot accept is not supported by kernel, fall back "
+                    "to asio");
+          use_io_uring_ = false;
+        }
+        DoAccept();
+      });
+  if (!accept_operation_) {
+    use_io_uring_ = false;
+    DoAccept();
+  }
+}
+#endif  // defined(DNSTOY_HAVE_IO_URING)
+
 void Server::DoAwaitStop() {
   signals_.async_wait([this](boost::system::error_code /*ec*/, int /*signo*/) {
     // The server is stopped by cancelling all outstanding asynchronous
     // operations. Once all operations have finished the io_context::run()
     // call will exit.
     stop_ = true;
+    statistics_signals_.cancel();
+    LogStatistics();
+#if defined(DNSTOY_HAVE_IO_URING)
+    // cancels multishot receive & accept and waits for pending replies
+    IoUring::get().Stop();
+#endif  // defined(DNSTOY_HAVE_IO_URING)
     auto udp_context = udp_context_.lock();
     if (udp_context) {
       udp_context->Stop();
     }
     acceptor_.close();
+    Resolver::Stop();
   });
 }
 
+void Server::DoAwaitStatisticsRequest() {
+  statistics_signals_.async_wait(
+      [this](boost::system::error_code error, int /*signo*/) {
+        if (error || stop_) {
+          return;
+        }
+        LogStatistics();
+        DoAwaitStatisticsRequest();
+      });
+}
+
+void Server::LogStatistics() {
+  auto& cache = Cache::get();
+  if (!cache.enabled()) {
+    return;
+  }
+  auto& statistics = cache.statistics();
+  LOG_INFO("cache hits:" << statistics.hits << " misses:" << statistics.misses
+                         << " insertions:" << statistics.insertions
+                         << " evictions:" << statistics.evictions
+                         << " rejections:" << statistics.rejections
+                         << " prefetches:" << statistics.prefetches
+                         << " stale hits:" << statistics.stale_hits
+                         << " entries:" << statistics.entries
+                         << " memory:" << statistics.memory_size);
+}
+
 }  // namespace dnstoy
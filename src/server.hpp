@@ -3,6 +3,7 @@
 #include <boost/asio.hpp>
 #include <iostream>
 #include <vector>
+#include "io_uring.hpp"
 #include "proxy_context.hpp"
 
 namespace dnstoy {
@@ -19,14 +20,22 @@ class Server {
   boost::asio::ip::tcp::socket tcp_socket_;
   boost::asio::ip::tcp::acceptor acceptor_;
   boost::asio::signal_set signals_;
+  boost::asio::signal_set statistics_signals_;
   boost::asio::ip::address listen_address_;
   std::weak_ptr<proxy::Context> udp_context_;
   uint16_t listen_port_;
 
   bool stop_;
+  bool use_io_uring_ = false;
+#if defined(DNSTOY_HAVE_IO_URING)
+  IoUring::OperationID accept_operation_ = 0;
+  void DoAcceptIoUring();
+#endif  // defined(DNSTOY_HAVE_IO_URING)
 
   void DoAccept();
   void DoAwaitStop();
+  void DoAwaitStatisticsRequest();
+  void LogStatistics();
 };
 
 }  // namespace dnstoy
@@ -0,0 +1,136 @@
+#include "server_selector.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+namespace dnstoy {
+
+bool ServerSelector::ParseStrategy(const std::string& name,
+                                   Strategy& strategy) {
+  if (name == "p2c") {
+    strategy = Strategy::P2C;
+  } else if (name == "least-latency") {
+    strategy = Strategy::LEAST_LATENCY;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void ServerSelector::reset(size_t server_count, Strategy strategy) {
+  strategy_ = strategy;
+  records_.clear();
+  records_.resize(server_count);
+  picks_since_refresh_ = weight_refresh_interval_;
+}
+
+size_t ServerSelector::Select() {
+  if (records_.size() < 2) {
+    return 0;
+  }
+  if (strategy_ == Strategy::LEAST_LATENCY) {
+    return WeightedPick();
+  }
+  return PowerOfTwoChoices(records_.size());
+}
+
+size_t ServerSelector::SelectExcept(size_t server_index) {
+  if (strategy_ == Strategy::LEAST_LATENCY) {
+    for (size_t i = 0; i < except_attempts_; i++) {
+      auto selected = WeightedPick();
+      if (selected != server_index) {
+        return selected;
+      }
+    }
+    // server_index takes almost every pick, the others are near-equal
+  }
+  return PowerOfTwoChoices(server_index);
+}
+
+std::vector<size_t> ServerSelector::Ranking() {
+  std::vector<size_t> ranking(records_.size());
+  std::iota(ranking.begin(), ranking.end(), 0);
+  std::stable_sort(ranking.begin(), ranking.end(), [this](size_t a, size_t b) {
+    return records_[a].estimated_delay() < records_[b].estimated_delay();
+  });
+  return ranking;
+}
+
+uint64_t ServerSelector::Cost(size_t server_index) {
+  auto& record = records_[server_index];
+  // a server answering within a millisecond still counts its load
+  return (uint64_t(record.estimated_delay()) + 1) * (record.load() + 1);
+}
+
+size_t ServerSelector::Random(size_t bound) {
+  std::uniform_int_distribution<size_t> distribution(0, bound - 1);
+  return distribution(random_engine_);
+}
+
+size_t ServerSelector::PowerOfTwoChoices(size_t except) {
+  auto count = records_.size() - (except < records_.size() ? 1 : 0);
+  // maps [0, count) to the servers but except
+  auto server = [except](size_t i) { return i < except ? i : i + 1; };
+  if (count < 2) {
+    return server(0);
+  }
+  auto first = Random(count);
+  auto second = Random(count - 1);
+  if (second >= first) {
+    second++;
+  }
+  first = server(first);
+  second = server(second);
+  return Cost(second) < Cost(first) ? second : first;
+}
+
+size_t ServerSelector::WeightedPick() {
+  if (++picks_since_refresh_ >= weight_refresh_interval_) {
+    RefreshWeights();
+  }
+  auto slot = Random(probabilities_.size());
+  std::uniform_real_distribution<double> distribution(0.0, 1.0);
+  return distribution(random_engine_) < probabilities_[slot] ? slot
+                                                             : aliases_[slot];
+}
+
+void ServerSelector::RefreshWeights() {
+  picks_since_refresh_ = 0;
+  auto count = records_.size();
+  probabilities_.resize(count);
+  aliases_.resize(count);
+  double weight_sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    probabilities_[i] = 1.0 / (records_[i].estimated_delay() + 1);
+    weight_sum += probabilities_[i];
+  }
+  // every slot is split between two servers at most, weights scaled to an
+  // average of 1 are moved from the large ones to fill up the small ones
+  std::vector<size_t> small;
+  std::vector<size_t> large;
+  for (size_t i = 0; i < count; i++) {
+    probabilities_[i] *= count / weight_sum;
+    aliases_[i] = i;
+    (probabilities_[i] < 1.0 ? small : large).push_back(i);
+  }
+  while (!small.empty() && !large.empty()) {
+    auto less = small.back();
+    small.pop_back();
+    auto more = large.back();
+    aliases_[less] = more;
+    probabilities_[more] -= 1.0 - probabilities_[less];
+    if (probabilities_[more] < 1.0) {
+      large.pop_back();
+      small.push_back(more);
+    }
+  }
+  // left by rounding errors, near 1
+  for (auto i : small) {
+    probabilities_[i] = 1.0;
+  }
+  for (auto i : large) {
+    probabilities_[i] = 1.0;
+  }
+}
+
+}  // namespace dnstoy
@@ -0,0 +1,64 @@
+#ifndef DNSTOY_SERVER_SELECTOR_H_
+#define DNSTOY_SERVER_SELECTOR_H_
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "performance_record.hpp"
+
+namespace dnstoy {
+
+// Picks the remote server of every query from the performance records of all
+// servers, in O(1) per query, by one of the strategies:
+// p2c: power of two choices, of two random servers the one with the lower
+//   estimated delay x outstanding queries, so near-equal servers share the
+//   load and a busy one is left alone until its queries drain
+// least-latency: weighted random, the share of every server is inversely
+//   proportional to its estimated delay
+// A server without samples estimates no delay, so it is tried soon.
+// thread-unsafe, designed for thread_local use
+class ServerSelector {
+ public:
+  enum class Strategy { P2C, LEAST_LATENCY };
+  // returns false on an unknown strategy name
+  static bool ParseStrategy(const std::string& name, Strategy& strategy);
+
+  void reset(size_t server_count, Strategy strategy);
+  size_t size() const { return records_.size(); }
+  PerformanceRecord& record(size_t server_index) {
+    return records_[server_index];
+  }
+  size_t Select();
+  // a server other than server_index, needs two servers at least
+  size_t SelectExcept(size_t server_index);
+  // server indexes by estimated delay, fastest first, O(n log n) for the
+  // occasional caller
+  std::vector<size_t> Ranking();
+
+ private:
+  // least-latency draws from a table of the weights of this many picks ago
+  static constexpr size_t weight_refresh_interval_ = 64;
+  // least-latency draws this often before it gives up on avoiding a server
+  static constexpr size_t except_attempts_ = 4;
+  Strategy strategy_ = Strategy::P2C;
+  std::vector<PerformanceRecord> records_;
+  std::mt19937 random_engine_{std::random_device()()};
+  // alias table of least-latency (Vose's alias method): a draw takes a
+  // random slot, then its server by the probability or else its alias
+  std::vector<double> probabilities_;
+  std::vector<size_t> aliases_;
+  size_t picks_since_refresh_ = weight_refresh_interval_;
+
+  uint64_t Cost(size_t server_index);
+  // in [0, bound)
+  size_t Random(size_t bound);
+  // except: the server to leave out, size() for none
+  size_t PowerOfTwoChoices(size_t except);
+  size_t WeightedPick();
+  void RefreshWeights();
+};
+
+}  // namespace dnstoy
+#endif  // DNSTOY_SERVER_SELECTOR_H_
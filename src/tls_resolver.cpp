@@ -1,12 +1,16 @@
 #include "tls_resolver.hpp"
 
+#include <algorithm>
 #include <boost/endian/conversion.hpp>
 #include <chrono>
+#include <cstring>
 
 #include "configuration.hpp"
 #include "engine.hpp"
+#include "kernel_tls.hpp"
 #include "logging.hpp"
 #include "query.hpp"
+#include "tls_session_store.hpp"
 
 namespace ssl = boost::asio::ssl;
 namespace endian = boost::endian;
@@ -20,41 +24,152 @@ using std::chrono::seconds;
 
 namespace dnstoy {
 
+namespace {
+
+// the app data of SSL is taken by the verify callback of asio
+int ResolverExDataIndex() {
+  static int index =
+      SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+  return index;
+}
+
+}  // namespace
+
 TlsResolver::TlsResolver(const std::string& hostname,
-                         const tcp_endpoints_type& endpoints)
+                         const tcp_endpoints_type& endpoints, bool tls)
     : ssl_context_(ssl::context::tls_client),
+      session_key_(hostname),
       hostname_(hostname),
       endpoints_(endpoints),
+      tls_(tls),
+      endpoint_rtts_(endpoints.size(), ParallelConnector::unmeasured_rtt),
+      early_data_enabled_(tls &&
+                          Configuration::get("tls-early-data").as<bool>()),
+      kernel_tls_enabled_(
+          tls && Configuration::get("tls-kernel-offload").as<bool>()),
+      keep_warm_interval_(
+          Configuration::get("keep-warm-interval").as<uint32_t>()),
       timeout_timer_(Engine::get().GetExecutor()),
       retry_timer_(Engine::get().GetExecutor()) {
   // TODO: support more tls option from configuration
-  // Use system cert
-  ssl_context_.set_default_verify_paths();
+  static const auto ca_file =
+      Configuration::get("tls-ca-file").as<std::string>();
+  if (ca_file.empty()) {
+    // Use system cert
+    ssl_context_.set_default_verify_paths();
+  } else {
+    // checked by Resolver::init
+    error_code error;
+    ssl_context_.load_verify_file(ca_file, error);
+  }
   // minor tls version set to 1.2
   ssl_context_.set_options(ssl::context::default_workarounds |
                            ssl::context::no_tlsv1 | ssl::context::no_tlsv1_1);
-  SSL_CTX_set_session_cache_mode(ssl_context_.native_handle(),
-                                 SSL_SESS_CACHE_NO_INTERNAL);
+  // sessions are kept by TlsSessionStore to be shared between workers,
+  // StoreNewSession is called once the handshake or a TLS 1.3 ticket
+  // establishes a session
+  SSL_CTX_set_session_cache_mode(
+      ssl_context_.native_handle(),
+      SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ssl_context_.native_handle(), StoreNewSession);
+  if (kernel_tls_enabled_) {
+    SSL_CTX_set_keylog_callback(ssl_context_.native_handle(),
+                                CaptureTrafficSecret);
+  }
+  if (!endpoints_.empty()) {
+    // servers behind the same hostname do not always share session keys
+    session_key_ += "/" + endpoints_.front().address().to_string();
+  }
 }
 
-TlsResolver::~TlsResolver() { SSL_SESSION_free(ssl_session_); }
-
 void TlsResolver::Resolve(QueryContext::pointer& query,
                           QueryResultHandler& handler) {
   query_manager_.QueueQuery(query, handler);
   if (io_status_ < IOStatus::READY) {
-    Reconnect();
+    // queued queries are written once the handshake is done, a connection
+    // in progress or in reconnect backoff is left alone
+    Connect();
   } else {
     DoWrite();
   }
 }
 
+void TlsResolver::Warm() {
+  if (io_status_ == IOStatus::NOT_INITIALIZED) {
+    Connect();
+  }
+}
+
+void TlsResolver::set_keep_warm(bool keep_warm) {
+  if (keep_warm_ == keep_warm) {
+    return;
+  }
+  keep_warm_ = keep_warm;
+  LOG_DEBUG(<< hostname_ << " keep warm " << keep_warm);
+  if (io_status_ >= IOStatus::READY) {
+    UpdateSocketTimeout(IdleTimeout());
+  } else if (keep_warm_) {
+    Warm();
+  }
+}
+
+milliseconds TlsResolver::IdleTimeout() const {
+  if (!sent_queries_.empty()) {
+    return response_timeout_;
+  }
+  if (KeepsWarm()) {
+    // probe before the server drops the idle connection
+    return std::min<milliseconds>(keep_warm_interval_, idle_timeout_ * 3 / 4);
+  }
+  return idle_timeout_;
+}
+
+bool TlsResolver::KeepsWarm() const {
+  return keep_warm_ && idle_timeout_ * 3 / 4 >= min_keep_warm_probe_interval_;
+}
+
+void TlsResolver::SendKeepWarmProbe() {
+  LOG_TRACE(<< hostname_ << " keep warm probe");
+  // ". NS" with RD, every recursive server answers it from cache, the empty
+  // OPT record makes room for the edns-tcp-keepalive option
+  static const uint8_t probe_message[] = {
+      0, 28,                   // tcp message length
+      0, 0, 1, 0,              // ID, flags
+      0, 1, 0, 0, 0, 0, 0, 1,  // QDCOUNT, ANCOUNT, NSCOUNT, ARCOUNT
+      0, 0, 2, 0, 1,           // root name, type NS, class IN
+      0, 0, 41, 4, 208,        // root name, type OPT, udp payload size 1232
+      0, 0, 0, 0, 0, 0,        // extended rcode and flags, RDLENGTH
+  };
+  auto probe = QueryContext::create();
+  probe->raw_message.assign(std::begin(probe_message),
+                            std::end(probe_message));
+  QueryResultHandler handler = [](QueryContext::pointer&&,
+                                  boost::system::error_code) {};
+  if (!keepalive_answer_pending_) {
+    // refreshes the TIMEOUT of the server
+    keepalive_requested_ = false;
+  }
+  query_manager_.QueueQuery(probe, handler);
+  DoWrite();
+}
+
+void TlsResolver::Close() {
+  timeout_timer_.cancel();
+  retry_timer_.cancel();
+  CloseConnection();
+}
+
 template <typename DurationType>
 void TlsResolver::UpdateSocketTimeout(DurationType duration) {
   LOG_TRACE(<< hostname_);
   timeout_timer_.expires_after(duration);
   timeout_timer_.async_wait([this](boost::system::error_code error) {
     if (!error) {
+      if (KeepsWarm() && io_status_ >= IOStatus::READY &&
+          sent_queries_.empty()) {
+        SendKeepWarmProbe();
+        return;
+      }
       LOG_DEBUG(<< hostname_ << " socket timed out");
       if (io_status_ == IOStatus::INITIALIZING || sent_queries_.empty()) {
         CloseConnection();
@@ -69,13 +184,18 @@ void TlsResolver::CloseConnection() {
   LOG_TRACE(<< hostname_);
   io_status_ = IOStatus::NOT_INITIALIZED;
   message_reader_.Stop();
+  if (connector_) {
+    connector_->Cancel();
+    connector_.reset();
+  }
   if (!socket_) {
     return;
   }
 
-  ssl_session_ = SSL_get1_session(socket_->native_handle());
-  socket_->lowest_layer().cancel();
-  socket_->lowest_layer().close();
+  // the socket is not open yet if the connection is still being established
+  error_code error;
+  socket_->lowest_layer().cancel(error);
+  socket_->lowest_layer().close(error);
   socket_.reset();
 }
 
@@ -119,69 +239,160 @@ void TlsResolver::Connect() {
       std::make_shared<stream_type>(Engine::get().GetExecutor(), ssl_context_);
   LOG_INFO(<< hostname_);
 
-  {
-    auto i = sent_queries_.begin();
-    while (i != sent_queries_.end()) {
-      auto& record = i->second;
-      if (record.first->status == QueryContext::Status::WAITING_FOR_ANSWER) {
-        query_manager_.CutInQueryRecord(std::move(record));
-      } else {
-        DropQuery(record);
-      }
-      i = sent_queries_.erase(i);
-    }
-  }
+  connect_time_ = std::chrono::steady_clock::now();
+  awaiting_first_answer_ = true;
+  kernel_tls_transmit_ = false;
+  keepalive_requested_ = false;
+  keepalive_answer_pending_ = false;
+  idle_timeout_ = default_idle_timeout_;
+  RequeueSentQueries();
 
-  socket_->set_verify_mode(ssl::verify_peer);
+  if (tls_) {
+    socket_->set_verify_mode(ssl::verify_peer);
 
-  if (ssl_session_) {
-    SSL_set_session(socket_->native_handle(), ssl_session_);
-    SSL_SESSION_free(ssl_session_);
-    ssl_session_ = nullptr;
-  }
+    SSL_set_ex_data(socket_->native_handle(), ResolverExDataIndex(), this);
 
-  {
-    // Enable automatic hostname checks
-    auto param = SSL_get0_param(socket_->native_handle());
+    {
+      // Enable automatic hostname checks
+      auto param = SSL_get0_param(socket_->native_handle());
 
-    X509_VERIFY_PARAM_set_hostflags(param,
-                                    X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
-    X509_VERIFY_PARAM_set1_host(param, hostname_.data(), hostname_.length());
-  }
+      X509_VERIFY_PARAM_set_hostflags(param,
+                                      X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+      X509_VERIFY_PARAM_set1_host(param, hostname_.data(),
+                                  hostname_.length());
+    }
 
-  // NOTE: consider add a configurable blacklist to untrust CNNIC / WoSign or
-  // left untrust configuration to OS
-  socket_->set_verify_callback(
-      [this](bool preverified, boost::asio::ssl::verify_context& ctx) {
-        char subject_name[256];
-        X509* cert = X509_STORE_CTX_get_current_cert(ctx.native_handle());
-        X509_NAME_oneline(X509_get_subject_name(cert), subject_name, 256);
-        LOG_INFO(" verifying " << hostname_ << " :" << subject_name);
-        return preverified;
-      });
+    // NOTE: consider add a configurable blacklist to untrust CNNIC / WoSign
+    // or left untrust configuration to OS
+    socket_->set_verify_callback(
+        [this](bool preverified, boost::asio::ssl::verify_context& ctx) {
+          char subject_name[256];
+          X509* cert = X509_STORE_CTX_get_current_cert(ctx.native_handle());
+          X509_NAME_oneline(X509_get_subject_name(cert), subject_name, 256);
+          LOG_INFO(" verifying " << hostname_ << " :" << subject_name);
+          return preverified;
+        });
+  }
 
   UpdateSocketTimeout(seconds(10));
 
   auto handler = [this, for_stream = socket_](
                      const boost::system::error_code& error,
-                     const tcp::endpoint& /*endpoint*/) {
-    if (!for_stream->lowest_layer().is_open()) {
-      return;
+                     tcp::socket&& socket, size_t endpoint_index,
+                     std::chrono::microseconds rtt) {
+    for (auto failed : connector_->failed_endpoints()) {
+      endpoint_rtts_[failed] = ParallelConnector::failed_rtt;
     }
+    connector_.reset();
     if (error) {
       LOG_ERROR(<< hostname_ << " connect failed: " << error.message());
       Reconnect();
       return;
     }
+    ParallelConnector::RecordRtt(endpoint_rtts_[endpoint_index], rtt);
+    LOG_DEBUG(<< hostname_ << " connected to " << endpoints_[endpoint_index]
+              << " in " << rtt.count() << "us");
+    for_stream->next_layer() = std::move(socket);
+    if (!tls_) {
+      HandleReady();
+      return;
+    }
+    // taken once connected, a failed connect wastes no ticket
+    auto session = TlsSessionStore::get().Get(session_key_);
+    ticket_unused_ = session && SSL_SESSION_get_protocol_version(session) >=
+                                    TLS1_3_VERSION;
+    if (session) {
+      SSL_set_session(socket_->native_handle(), session);
+      SSL_SESSION_free(session);
+    }
+    if (early_data_enabled_ && ticket_unused_ && WriteEarlyData()) {
+      async_write(socket_->next_layer(), boost::asio::buffer(write_buffer_),
+                  [this, for_stream](const boost::system::error_code& error,
+                                     std::size_t /*bytes_transfered*/) {
+                    if (!for_stream->lowest_layer().is_open()) {
+                      return;
+                    }
+                    if (error) {
+                      LOG_ERROR(<< hostname_ << " early data write failed "
+                                << error.message());
+                      Reconnect();
+                      return;
+                    }
+                    Handshake();
+                  });
+      return;
+    }
     Handshake();
   };
 
-  boost::asio::async_connect(socket_->lowest_layer(), endpoints_,
-                             std::move(handler));
+  connector_ = ParallelConnector::create(Engine::get().GetExecutor());
+  connector_->Start(
+      endpoints_,
+      ParallelConnector::PreferredOrder(endpoints_, endpoint_rtts_),
+      std::move(handler));
+}
+
+void TlsResolver::RequeueSentQueries() {
+  if (keepalive_answer_pending_) {
+    // the option is asked again with the queries sent next
+    keepalive_requested_ = false;
+    keepalive_answer_pending_ = false;
+  }
+  sent_queries_.Drain([this](uint16_t id, QueryManager::QueryRecord& record) {
+    id_allocator_.Release(id);
+    if (record.first->status == QueryContext::Status::WAITING_FOR_ANSWER) {
+      query_manager_.CutInQueryRecord(std::move(record));
+    } else {
+      DropQuery(record);
+    }
+  });
+}
+
+bool TlsResolver::WriteEarlyData() {
+  auto ssl = socket_->native_handle();
+  auto session = SSL_get_session(ssl);
+  if (!session || !SSL_SESSION_get_max_early_data(session) ||
+      !query_manager_.QueueSize()) {
+    return false;
+  }
+  // queries are idempotent, so they are safe to be replayed (rfc8446 8)
+  GatherQueries(std::min<size_t>(SSL_SESSION_get_max_early_data(session),
+                                 early_data_size_limit_));
+  if (sent_queries_.empty()) {
+    return false;
+  }
+  // asio only flushes output produced during its own operations, so
+  // ClientHello and early data are written to a memory BIO and sent to the
+  // socket before the handshake, which then continues on the stream's BIO
+  SSL_set_connect_state(ssl);
+  auto stream_bio = SSL_get_wbio(ssl);
+  auto memory_bio = BIO_new(BIO_s_mem());
+  BIO_up_ref(stream_bio);
+  BIO_up_ref(memory_bio);
+  SSL_set0_wbio(ssl, memory_bio);
+  size_t written = 0;
+  auto result = SSL_write_early_data(ssl, write_buffer_.data(),
+                                     write_buffer_.size(), &written) &&
+                written == write_buffer_.size();
+  SSL_set0_wbio(ssl, stream_bio);
+  if (result) {
+    LOG_TRACE(<< hostname_ << " " << sent_queries_.size()
+              << " queries written as early data");
+  } else {
+    LOG_DEBUG(<< hostname_ << " early data not written");
+    ERR_clear_error();
+    RequeueSentQueries();
+  }
+  // ClientHello has to be sent anyway once it is written
+  char* data;
+  auto size = BIO_get_mem_data(memory_bio, &data);
+  write_buffer_.assign(data, data + size);
+  BIO_free(memory_bio);
+  return size > 0;
 }
 
 void TlsResolver::Handshake() {
-  UpdateSocketTimeout(idle_timeout_);
+  UpdateSocketTimeout(IdleTimeout());
   socket_->async_handshake(
       boost::asio::ssl::stream_base::client,
       [this, for_stream = socket_](const boost::system::error_code& error) {
@@ -193,21 +404,50 @@ void TlsResolver::Handshake() {
           Reconnect();
           return;
         }
-        io_status_ = IOStatus::READY;
-        retry_connect_counter_ = 0;
-        LOG_TRACE(<< hostname_ << " handshake success");
-        UpdateSocketTimeout(idle_timeout_);
-        if (query_manager_.QueueSize()) {
-          LOG_TRACE("do write");
-          DoWrite();
+        if (!sent_queries_.empty() &&
+            SSL_get_early_data_status(socket_->native_handle()) !=
+                SSL_EARLY_DATA_ACCEPTED) {
+          // server rejected early data, send the queries again
+          LOG_DEBUG(<< hostname_ << " early data rejected");
+          RequeueSentQueries();
         }
-        message_reader_.Start(
-            socket_, std::bind(&TlsResolver::HandleServerMessage, this,
-                               std::placeholders::_1, std::placeholders::_2,
-                               std::placeholders::_3));
+        if (kernel_tls_enabled_) {
+          kernel_tls_transmit_ = KernelTls::EnableTransmit(
+              socket_->native_handle(),
+              socket_->lowest_layer().native_handle(), traffic_secret_);
+          OPENSSL_cleanse(traffic_secret_.data(), traffic_secret_.size());
+          traffic_secret_.clear();
+          LOG_DEBUG(<< hostname_ << " kernel tls transmit "
+                    << (kernel_tls_transmit_ ? "enabled" : "unavailable"));
+        }
+        LOG_TRACE(<< hostname_ << " handshake success"
+                  << (SSL_session_reused(socket_->native_handle())
+                          ? ", session resumed"
+                          : ""));
+        HandleReady();
       });
 }
 
+void TlsResolver::HandleReady() {
+  io_status_ = IOStatus::READY;
+  retry_connect_counter_ = 0;
+  UpdateSocketTimeout(IdleTimeout());
+  if (query_manager_.QueueSize()) {
+    LOG_TRACE("do write");
+    DoWrite();
+  }
+  auto handler =
+      std::bind(&TlsResolver::HandleServerMessage, this, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3);
+  if (tls_) {
+    message_reader_.Start(socket_, std::move(handler));
+  } else {
+    // shares the ownership of the stream, pending reads keep it alive
+    std::shared_ptr<tcp::socket> tcp_socket(socket_, &socket_->next_layer());
+    message_reader_.Start(tcp_socket, std::move(handler));
+  }
+}
+
 void TlsResolver::DoWrite() {
   if (io_status_ == IOStatus::WRITING) {
     LOG_TRACE(<< hostname_ << " already writing");
@@ -218,71 +458,132 @@ void TlsResolver::DoWrite() {
     Reconnect();
     return;
   }
-  UpdateSocketTimeout(idle_timeout_);
 
-  QueryManager::QueryRecord record;
-  int16_t id;
+  if (kernel_tls_transmit_ &&
+      KernelTls::OpenSslOutputDiscarded(socket_->native_handle())) {
+    // rfc8446 4.6.3: the KeyUpdate OpenSSL answered a server request with has
+    // to go before any more application data, a new connection is the way
+    LOG_INFO(<< hostname_ << " tls record written by OpenSSL on kernel tls"
+             << " connection, reconnect");
+    Reconnect();
+    return;
+  }
 
-  bool got_record = false;
-  while (query_manager_.GetRecord(record, id)) {
-    if (record.first->status != QueryContext::Status::WAITING_FOR_ANSWER) {
-      DropQuery(record);
-      continue;
-    }
-    got_record = true;
-    break;
+  // gather queued queries into one buffer, so a burst of queries costs a few
+  // full TLS records and write completions instead of one per query
+  io_status_ = IOStatus::WRITING;
+  auto record_count = GatherQueries(write_size_limit_);
+  if (id_allocator_.empty() && query_manager_.QueueSize()) {
+    // the queued queries are written once answers release their IDs
+    LOG_DEBUG(<< hostname_ << " out of query IDs, "
+              << query_manager_.QueueSize() << " queries held");
   }
-  if (!got_record) {
+  if (!record_count) {
     LOG_TRACE(<< hostname_ << " queue clear.");
+    io_status_ = IOStatus::READY;
     return;
   }
-  io_status_ = IOStatus::WRITING;
-  using ResultType = dns::MessageEncoder::ResultType;
-  auto& context = *record.first;
-
-  LOG_TRACE(<< hostname_ << " query "
-            << (context.query.questions.size() ? context.query.questions[0].name
-                                               : "")
-            << context.query << "|" << id << " start write");
-
-  auto encode_result = dns::MessageEncoder::RewriteIDToTcpMessage(
-      context.raw_message.data(), context.raw_message.size(), id);
-  if (encode_result != ResultType::good) {
-    LOG_TRACE(<< hostname_ << " query" << context.query.header.id << "|" << id
-              << "encode failed");
-    DropQuery(record);
-    return;
+  LOG_TRACE(<< hostname_ << " write " << record_count << " queries");
+  UpdateSocketTimeout(IdleTimeout());
+  auto handler = [this, for_stream = socket_](
+                     const boost::system::error_code& error,
+                     std::size_t /*bytes_transfered*/) {
+    if (!for_stream->lowest_layer().is_open()) {
+      return;
+    }
+    if (error) {
+      if (error != boost::asio::error::operation_aborted) {
+        LOG_ERROR(<< hostname_ << " write failed " << error.message());
+      }
+      Reconnect();
+      return;
+    }
+    io_status_ = IOStatus::READY;
+    DoWrite();
+  };
+  if (kernel_tls_transmit_ || !tls_) {
+    // the kernel encrypts or there is nothing to encrypt, skip the record
+    // layer of OpenSSL
+    async_write(socket_->next_layer(), boost::asio::buffer(write_buffer_),
+                std::move(handler));
+  } else {
+    async_write(*socket_, boost::asio::buffer(write_buffer_),
+                std::move(handler));
   }
-  while (sent_queries_.find(id) != sent_queries_.end()) {
-    if (context.status != QueryContext::Status::WAITING_FOR_ANSWER) {
+}
+
+size_t TlsResolver::GatherQueries(size_t size_limit) {
+  write_buffer_.clear();
+  size_t record_count = 0;
+  QueryManager::QueryRecord record;
+  while (record_count < write_record_limit_ &&
+         write_buffer_.size() < size_limit && !id_allocator_.empty() &&
+         query_manager_.GetRecord(record)) {
+    if (record.first->status != QueryContext::Status::WAITING_FOR_ANSWER) {
       DropQuery(record);
-      return;
+      continue;
     }
-    Engine::get().GetExecutor().run_one();
-  }
-  sent_queries_[id] = record;
-  async_write(
-      *socket_, boost::asio::buffer(context.raw_message),
-      [this, for_stream = socket_, hold_buffer = record.first](
-          const boost::system::error_code& error,
-          std::size_t /*bytes_transfered*/) {
-        if (!for_stream->lowest_layer().is_open()) {
-          return;
-        }
-        if (error) {
-          if (error != boost::asio::error::operation_aborted) {
-            LOG_ERROR(<< hostname_ << " write failed " << error.message());
-          }
-          Reconnect();
-          return;
-        }
-        io_status_ = IOStatus::READY;
-        DoWrite();
-      });
+    using ResultType = dns::MessageEncoder::ResultType;
+    auto& context = *record.first;
+    int16_t id = id_allocator_.Allocate();
+
+    LOG_TRACE(<< hostname_ << " query "
+              << (context.query.questions.size()
+                      ? context.query.questions[0].name
+                      : "")
+              << context.query << "|" << id << " start write");
+
+    auto encode_result = dns::MessageEncoder::RewriteIDToTcpMessage(
+        context.raw_message.data(), context.raw_message.size(), id);
+    if (encode_result != ResultType::good) {
+      LOG_TRACE(<< hostname_ << " query" << context.query.header.id << "|"
+                << id << "encode failed");
+      id_allocator_.Release(id);
+      DropQuery(record);
+      continue;
+    }
+    // rfc7828 3.2.1: the option is empty in queries
+    static const uint8_t keepalive_option[] = {
+        0, dns::EDNSOption::TCP_KEEPALIVE, 0, 0};
+    auto keepalive_size = keepalive_requested_ ? 0 : sizeof(keepalive_option);
+    auto message_size = context.raw_message.size() + keepalive_size;
+    if (record_count && write_buffer_.size() + message_size > size_limit) {
+      id_allocator_.Release(id);
+      query_manager_.CutInQueryRecord(std::move(record));
+      break;
+    }
+    auto message_offset = write_buffer_.size();
+    write_buffer_.insert(write_buffer_.end(), context.raw_message.begin(),
+                         context.raw_message.end());
+    // only the copy to send carries the option, the raw message is shared
+    // with the cache and other resolvers
+    if (!keepalive_requested_ &&
+        dns::MessageEncoder::AppendEDNSOptionToRawTcpMessage(
+            write_buffer_, message_offset, keepalive_option,
+            sizeof(keepalive_option)) == ResultType::good) {
+      keepalive_requested_ = true;
+      keepalive_answer_pending_ = true;
+      keepalive_query_id_ = id;
+    }
+    sent_queries_.Insert(id, std::move(record));
+    record_count++;
+  }
+  return record_count;
 }
 
 void TlsResolver::HandleServerMessage(MessageReader::Reason reason,
                                       const uint8_t* data, uint16_t data_size) {
+  if (reason == MessageReader::Reason::PEER_CLOSED ||
+      reason == MessageReader::Reason::IO_ERROR) {
+    LOG_DEBUG(<< hostname_ << " connection lost");
+    // sent queries are never answered on this connection
+    if (KeepsWarm() || !sent_queries_.empty()) {
+      Reconnect();
+    } else {
+      CloseConnection();
+    }
+    return;
+  }
   if (reason != MessageReader::Reason::NEW_MESSAGE) {
     LOG_TRACE(<< hostname_ << " ignore reason:" << static_cast<int>(reason));
     return;
@@ -291,7 +592,18 @@ void TlsResolver::HandleServerMessage(MessageReader::Reason reason,
     LOG_ERROR(<< hostname_ << " empty message!");
     return;
   }
-  UpdateSocketTimeout(idle_timeout_);
+  if (awaiting_first_answer_) {
+    awaiting_first_answer_ = false;
+    LOG_INFO(<< hostname_ << " first answer "
+             << std::chrono::duration_cast<milliseconds>(
+                    std::chrono::steady_clock::now() - connect_time_)
+                    .count()
+             << "ms after connect"
+             << (SSL_get_early_data_status(socket_->native_handle()) ==
+                         SSL_EARLY_DATA_ACCEPTED
+                     ? ", early data accepted"
+                     : ""));
+  }
   using ResultType = dns::MessageDecoder::ResultType;
   int16_t id;
   auto decode_result =
@@ -300,7 +612,21 @@ void TlsResolver::HandleServerMessage(MessageReader::Reason reason,
     LOG_ERROR(<< hostname_ << " ?|? answer decode failed");
     return;
   }
-  auto query_handle = sent_queries_.extract(id);
+  QueryManager::QueryRecord record;
+  auto found = sent_queries_.Extract(id, record);
+  auto carries_keepalive = false;
+  if (found) {
+    id_allocator_.Release(id);
+    if (keepalive_answer_pending_ && id == keepalive_query_id_) {
+      keepalive_answer_pending_ = false;
+      carries_keepalive = FollowKeepaliveTimeout(data, data_size);
+    }
+    if (io_status_ == IOStatus::READY && query_manager_.QueueSize()) {
+      // queries held back as IDs ran out
+      DoWrite();
+    }
+  }
+  UpdateSocketTimeout(IdleTimeout());
 
 #ifndef NDEBUG
   dns::Message message;
@@ -309,7 +635,7 @@ void TlsResolver::HandleServerMessage(MessageReader::Reason reason,
       data_size - offsetof(dns::RawTcpMessage, message));
 #endif
 
-  if (!query_handle) {
+  if (!found) {
     LOG_ERROR(<< hostname_ << " ?|"
 #ifdef NDEBUG
               << id
@@ -319,7 +645,6 @@ void TlsResolver::HandleServerMessage(MessageReader::Reason reason,
               << " answer find no record");
     return;
   }
-  auto& record = query_handle.mapped();
   auto& context = record.first;
   if (context->status != QueryContext::Status::WAITING_FOR_ANSWER) {
     DropQuery(record);
@@ -327,14 +652,60 @@ void TlsResolver::HandleServerMessage(MessageReader::Reason reason,
   }
   context->status = QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER;
   context->raw_message.assign(data, data + data_size);
-  dns::MessageEncoder::RewriteIDToTcpMessage(
-      context->raw_message.data(), data_size, context->query.header.id);
+  if (carries_keepalive) {
+    // rfc7828 3.3.2: the option is hop by hop, it is never forwarded
+    dns::MessageEncoder::RemoveEDNSOptionFromRawTcpMessage(
+        context->raw_message, dns::EDNSOption::TCP_KEEPALIVE);
+  }
+  dns::MessageEncoder::RewriteIDToTcpMessage(context->raw_message.data(),
+                                             context->raw_message.size(),
+                                             context->query.header.id);
 
   LOG_TRACE(<< context->query.header.id << "|" << message << " answered");
   record.second(std::move(record.first), boost::system::errc::make_error_code(
                                              boost::system::errc::success));
 }
 
+bool TlsResolver::FollowKeepaliveTimeout(const uint8_t* data,
+                                        uint16_t data_size) {
+  constexpr auto header_size = offsetof(dns::RawTcpMessage, message);
+  size_t option_offset;
+  if (data_size < header_size ||
+      dns::MessageDecoder::FindEDNSOption(
+          data + header_size, data_size - header_size,
+          dns::EDNSOption::TCP_KEEPALIVE,
+          option_offset) != dns::MessageDecoder::ResultType::good) {
+    LOG_DEBUG(<< hostname_ << " no edns-tcp-keepalive in answer");
+    return false;
+  }
+  auto option = reinterpret_cast<const dns::EDNSOption*>(
+      data + header_size + option_offset);
+  // rfc7828 3.1: TIMEOUT is in units of 100 milliseconds
+  uint16_t timeout;
+  if (endian::big_to_native(option->length) == sizeof(timeout)) {
+    memcpy(&timeout, option->data, sizeof(timeout));
+    idle_timeout_ = milliseconds(endian::big_to_native(timeout) * 100);
+    LOG_DEBUG(<< hostname_ << " idle timeout " << idle_timeout_.count()
+              << "ms advertised");
+  }
+  return true;
+}
+
+int TlsResolver::StoreNewSession(SSL* ssl, SSL_SESSION* session) {
+  auto resolver =
+      static_cast<TlsResolver*>(SSL_get_ex_data(ssl, ResolverExDataIndex()));
+  LOG_TRACE(<< resolver->hostname_ << " new session");
+  TlsSessionStore::get().Put(resolver->session_key_, session);
+  // the store keeps its own copy
+  return 0;
+}
+
+void TlsResolver::CaptureTrafficSecret(const SSL* ssl, const char* line) {
+  auto resolver =
+      static_cast<TlsResolver*>(SSL_get_ex_data(ssl, ResolverExDataIndex()));
+  KernelTls::ParseClientTrafficSecret(line, resolver->traffic_secret_);
+}
+
 void TlsResolver::DropQuery(QueryManager::QueryRecord& record) {
   error_code error;
   switch (record.first->status) {
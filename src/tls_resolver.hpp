@@ -6,27 +6,46 @@
 #include <chrono>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <variant>
 
+#include "in_flight_table.hpp"
 #include "message_reader.hpp"
+#include "parallel_connector.hpp"
 #include "query.hpp"
+#include "query_id_allocator.hpp"
 #include "resolver.hpp"
 
 namespace dnstoy {
 
+// Without tls it serves plain tcp servers (tcp@port) the same way, queries
+// and answers then go through the tcp socket under the ssl stream.
 // thread-unsafe, designed for thread_local use
 class TlsResolver {
  public:
   using tcp_endpoints_type = std::vector<boost::asio::ip::tcp::endpoint>;
-  TlsResolver(const std::string& hostname, const tcp_endpoints_type& endpoints);
+  TlsResolver(const std::string& hostname, const tcp_endpoints_type& endpoints,
+              bool tls = true);
   void Resolve(QueryContext::pointer& query, QueryResultHandler& handler);
-  ~TlsResolver();
+  // connects in advance if not connected nor waiting for reconnect backoff
+  void Warm();
+  void Close();
+  // keeps the connection open, it is probed every keep-warm-interval when
+  // idle and reconnected when lost
+  void set_keep_warm(bool keep_warm);
+  // connection failed and the next attempt is delayed by backoff
+  bool retry_delayed() const {
+    return io_status_ == IOStatus::INITIALIZATION_DELAYED_FOR_RETRY;
+  }
+  bool ready() const { return io_status_ >= IOStatus::READY; }
+  size_t outstanding_queries() const {
+    return query_manager_.QueueSize() + sent_queries_.size();
+  }
 
  private:
   using stream_type = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
   boost::asio::ssl::context ssl_context_;
-  SSL_SESSION* ssl_session_ = nullptr;
+  // key of the sessions of this server in TlsSessionStore
+  std::string session_key_;
   // NOTE:
   // do not use unique_ptr for stream as A stream object must not be destroyed
   // while there are pending asynchronous operations associated with it.
@@ -37,9 +56,51 @@ class TlsResolver {
   QueryManager query_manager_;
   std::string hostname_;
   tcp_endpoints_type endpoints_;
-  std::unordered_map<int16_t, QueryManager::QueryRecord> sent_queries_;
+  bool tls_;
+  // connect time of every endpoint, reconnects try the fastest first
+  std::vector<std::chrono::microseconds> endpoint_rtts_;
+  ParallelConnector::pointer connector_;
+  InFlightTable<> sent_queries_;
+  QueryIdAllocator id_allocator_;
   MessageReader message_reader_;
-  std::chrono::seconds idle_timeout_ = std::chrono::seconds(30);
+  // queued queries gathered for one write, bounded by the payload size of a
+  // full TLS record
+  std::vector<uint8_t> write_buffer_;
+  static constexpr size_t write_size_limit_ = 16 * 1024;
+  static constexpr size_t write_record_limit_ = 256;
+  // tls-early-data: queries queued at connect are sent with the ClientHello
+  // of resumed TLS 1.3 sessions
+  bool early_data_enabled_;
+  // keeps ClientHello and early data within the memory BIO of the stream
+  static constexpr size_t early_data_size_limit_ = 8 * 1024;
+  // the session of the connection is a TLS 1.3 ticket taken from
+  // TlsSessionStore, which no other connection gets, so its early data is
+  // not a replay anti-replay servers reject
+  bool ticket_unused_ = false;
+  // tls-kernel-offload: writes go through kernel TLS once the handshake has
+  // installed the client traffic key
+  bool kernel_tls_enabled_;
+  bool kernel_tls_transmit_ = false;
+  std::vector<uint8_t> traffic_secret_;
+  bool keep_warm_ = false;
+  std::chrono::seconds keep_warm_interval_;
+  std::chrono::steady_clock::time_point connect_time_;
+  bool awaiting_first_answer_ = false;
+  // rfc7828: the edns-tcp-keepalive option goes with the first query carrying
+  // EDNS on every connection and with keep warm probes, the idle timeout then
+  // follows the TIMEOUT the server answers
+  bool keepalive_requested_ = false;
+  bool keepalive_answer_pending_ = false;
+  int16_t keepalive_query_id_ = 0;
+  static constexpr std::chrono::milliseconds default_idle_timeout_ =
+      std::chrono::seconds(30);
+  std::chrono::milliseconds idle_timeout_ = default_idle_timeout_;
+  // a connection with unanswered queries is reconnected after this
+  static constexpr std::chrono::milliseconds response_timeout_ =
+      std::chrono::seconds(30);
+  // servers timing out idle connections faster are not kept warm
+  static constexpr std::chrono::milliseconds min_keep_warm_probe_interval_ =
+      std::chrono::seconds(1);
   boost::asio::steady_timer timeout_timer_;
   std::chrono::milliseconds first_retry_interval_ =
       std::chrono::milliseconds(500);
@@ -62,10 +123,29 @@ class TlsResolver {
   void Reconnect();
   void Connect();
   void Handshake();
+  // starts writing queued queries and reading answers
+  void HandleReady();
   void DoWrite();
+  std::chrono::milliseconds IdleTimeout() const;
+  bool KeepsWarm() const;
+  void SendKeepWarmProbe();
+  // follows the edns-tcp-keepalive TIMEOUT of an answer, returns true if the
+  // answer carries the option
+  bool FollowKeepaliveTimeout(const uint8_t* data, uint16_t data_size);
+  // moves queued queries to write_buffer_ and sent_queries_, returns the
+  // number of queries gathered
+  size_t GatherQueries(size_t size_limit);
+  // returns true if ClientHello and early data are left in write_buffer_ to
+  // be sent before the handshake
+  bool WriteEarlyData();
+  // puts sent queries back to the queue, as they will never be answered on
+  // the current connection
+  void RequeueSentQueries();
   void HandleServerMessage(MessageReader::Reason reason, const uint8_t* data,
                            uint16_t data_size);
   void DropQuery(QueryManager::QueryRecord& record);
+  static int StoreNewSession(SSL* ssl, SSL_SESSION* session);
+  static void CaptureTrafficSecret(const SSL* ssl, const char* line);
 };
 
 }  // namespace dnstoy
@@ -0,0 +1,212 @@
+#include "tls_session_store.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <boost/endian/conversion.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#include "logging.hpp"
+
+namespace endian = boost::endian;
+using std::string;
+
+namespace dnstoy {
+
+namespace {
+
+// file layout: magic, then for every session
+// [key size:uint16][key][session size:uint32][DER encoded session]
+constexpr char file_magic[] = {'D', 'N', 'S', 'T', 'O', 'Y', 'S', '1'};
+// a DER encoded session is a few KiB at most, larger sizes are corruption
+constexpr uint32_t max_session_size = 64 * 1024;
+
+template <typename IntegerType>
+bool ReadInteger(std::istream& stream, IntegerType& value) {
+  stream.read(reinterpret_cast<char*>(&value), sizeof(value));
+  value = endian::big_to_native(value);
+  return bool(stream);
+}
+
+template <typename IntegerType>
+void WriteInteger(std::ostream& stream, IntegerType value) {
+  value = endian::native_to_big(value);
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}  // namespace
+
+void TlsSessionStore::Put(const string& key, SSL_SESSION* session) {
+  if (!SSL_SESSION_is_resumable(session)) {
+    return;
+  }
+  auto size = i2d_SSL_SESSION(session, nullptr);
+  if (size <= 0) {
+    return;
+  }
+  std::vector<uint8_t> encoded(size);
+  auto data = encoded.data();
+  i2d_SSL_SESSION(session, &data);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  Append(key, std::move(encoded));
+}
+
+SSL_SESSION* TlsSessionStore::Get(const string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto i = sessions_.find(key);
+  if (i == sessions_.end()) {
+    return nullptr;
+  }
+  auto& sessions = i->second;
+  SSL_SESSION* session = nullptr;
+  while (!session && !sessions.empty()) {
+    session = Decode(sessions.back());
+    // a TLS 1.2 session may resume many connections
+    if (!session ||
+        SSL_SESSION_get_protocol_version(session) >= TLS1_3_VERSION) {
+      sessions.pop_back();
+    }
+  }
+  if (sessions.empty()) {
+    sessions_.erase(i);
+  }
+  return session;
+}
+
+void TlsSessionStore::Append(const string& key,
+                             std::vector<uint8_t>&& encoded) {
+  auto& sessions = sessions_[key];
+  sessions.emplace_back(std::move(encoded));
+  if (sessions.size() > sessions_per_key_) {
+    sessions.pop_front();
+  }
+}
+
+SSL_SESSION* TlsSessionStore::Decode(const std::vector<uint8_t>& encoded) {
+  auto data = encoded.data();
+  auto session = d2i_SSL_SESSION(nullptr, &data, encoded.size());
+  if (!session) {
+    return nullptr;
+  }
+  if (!SSL_SESSION_is_resumable(session) ||
+      SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) <=
+          std::time(nullptr)) {
+    SSL_SESSION_free(session);
+    return nullptr;
+  }
+  return session;
+}
+
+bool TlsSessionStore::Load(const string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    // nothing saved yet
+    return true;
+  }
+  char magic[sizeof(file_magic)];
+  file.read(magic, sizeof(magic));
+  if (!file || !std::equal(magic, magic + sizeof(magic), file_magic)) {
+    LOG_ERROR(<< path << " is not a tls session file");
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t loaded = 0;
+  while (file.peek() != std::char_traits<char>::eof()) {
+    uint16_t key_size;
+    uint32_t session_size;
+    string key;
+    std::vector<uint8_t> encoded;
+    if (!ReadInteger(file, key_size)) {
+      break;
+    }
+    key.resize(key_size);
+    file.read(key.data(), key_size);
+    if (!ReadInteger(file, session_size)) {
+      break;
+    }
+    if (session_size > max_session_size) {
+      LOG_ERROR(<< path << " is corrupt, session of " << session_size
+                << " bytes");
+      break;
+    }
+    encoded.resize(session_size);
+    file.read(reinterpret_cast<char*>(encoded.data()), session_size);
+    if (!file) {
+      break;
+    }
+    auto session = Decode(encoded);
+    if (!session) {
+      continue;
+    }
+    SSL_SESSION_free(session);
+    Append(key, std::move(encoded));
+    loaded++;
+  }
+  if (file.fail()) {
+    LOG_ERROR(<< path << " is truncated");
+  }
+  LOG_INFO(<< "loaded " << loaded << " tls session(s) from " << path);
+  return true;
+}
+
+bool TlsSessionStore::Save(const string& path) {
+  std::ostringstream content;
+  content.write(file_magic, sizeof(file_magic));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t saved = 0;
+    // unused tickets only, oldest first as they are loaded again
+    for (auto& [key, sessions] : sessions_) {
+      for (auto& encoded : sessions) {
+        WriteInteger(content, static_cast<uint16_t>(key.size()));
+        content.write(key.data(), key.size());
+        WriteInteger(content, static_cast<uint32_t>(encoded.size()));
+        content.write(reinterpret_cast<const char*>(encoded.data()),
+                      encoded.size());
+        saved++;
+      }
+    }
+    LOG_INFO(<< "saving " << saved << " tls session(s) to " << path);
+  }
+
+  // write a temporary file and rename it, a crash never leaves a partial file.
+  // Sessions resume connections and send early data, only the owner reads
+  // them, fchmod covers a temporary file left by an older version
+  auto temporary_path = path + ".tmp";
+  auto fd =
+      open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+           S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    LOG_ERROR(<< "can not write " << temporary_path << ": "
+              << strerror(errno));
+    return false;
+  }
+  auto data = content.str();
+  auto result = fchmod(fd, S_IRUSR | S_IWUSR) == 0;
+  for (size_t written = 0; result && written < data.size();) {
+    auto size = write(fd, data.data() + written, data.size() - written);
+    if (size < 0 && errno == EINTR) {
+      continue;
+    }
+    result = size > 0;
+    written += result ? size : 0;
+  }
+  result = close(fd) == 0 && result;
+  if (!result || std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    LOG_ERROR(<< "can not write " << path << ": " << strerror(errno));
+    unlink(temporary_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace dnstoy
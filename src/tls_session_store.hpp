@@ -0,0 +1,55 @@
+#ifndef DNSTOY_TLS_SESSION_STORE_H_
+#define DNSTOY_TLS_SESSION_STORE_H_
+
+#include <openssl/ssl.h>
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dnstoy {
+
+// TLS sessions of the remote servers shared by every worker thread, so a
+// connection opened by any worker resumes a session instead of doing a full
+// handshake. A TLS 1.3 ticket resumes one connection only (rfc8446 C.4):
+// several are kept of every server, Get hands each out once, and the tickets
+// the server sends on every connection refill them.
+// Sessions are kept DER encoded, which is also the format of the
+// tls-session-file written on exit and loaded on start, so resumption
+// survives restarts.
+// thread-safe
+class TlsSessionStore {
+ public:
+  static inline TlsSessionStore& get() {
+    static TlsSessionStore object;
+    return object;
+  }
+
+  // keeps a copy of session, the caller still owns it
+  void Put(const std::string& key, SSL_SESSION* session);
+  // returns a new session the caller must free, the latest of key which is
+  // still resumable, nullptr if there is none. A TLS 1.3 session is removed,
+  // so no other connection uses its ticket
+  SSL_SESSION* Get(const std::string& key);
+  // returns false if the file exists but can not be read
+  bool Load(const std::string& path);
+  bool Save(const std::string& path);
+
+ private:
+  // of every key, the older ones are dropped
+  static constexpr size_t sessions_per_key_ = 8;
+  std::mutex mutex_;
+  // oldest first
+  std::unordered_map<std::string, std::deque<std::vector<uint8_t>>> sessions_;
+
+  TlsSessionStore() = default;
+  // caller holds mutex_
+  void Append(const std::string& key, std::vector<uint8_t>&& encoded);
+  // nullptr if encoded is not a session, or the session has expired
+  static SSL_SESSION* Decode(const std::vector<uint8_t>& encoded);
+};
+
+}  // namespace dnstoy
+#endif  // DNSTOY_TLS_SESSION_STORE_H_
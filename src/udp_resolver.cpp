@@ -0,0 +1,480 @@
+#include "udp_resolver.hpp"
+
+#include <algorithm>
+#include <boost/endian/conversion.hpp>
+#include <limits>
+
+#include "dns.hpp"
+#include "engine.hpp"
+#include "logging.hpp"
+
+namespace endian = boost::endian;
+using boost::asio::async_read;
+using boost::asio::async_write;
+using boost::system::error_code;
+using std::chrono::steady_clock;
+
+namespace dnstoy {
+
+namespace {
+
+constexpr auto tcp_header_size = offsetof(dns::RawTcpMessage, message);
+
+// rfc4343 3: case is folded for ASCII letters only
+inline uint8_t LowerCase(uint8_t c) {
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// compares the question of a raw tcp query with the one of a raw tcp answer,
+// ignoring letter case within labels, length octets, QTYPE and QCLASS must
+// be equal
+bool QuestionMatches(const std::vector<uint8_t>& query, const uint8_t* answer,
+                     size_t answer_size) {
+  auto offset = tcp_header_size + sizeof(dns::RawHeader);
+  while (offset < query.size() && query[offset] != 0) {
+    auto label_size = query[offset];
+    if ((label_size & dns::RawLabel::Flag::MASK) !=
+        dns::RawLabel::Flag::NORMAL) {
+      return false;
+    }
+    auto label_end = offset + 1 + label_size;
+    if (label_end > query.size() || label_end > answer_size ||
+        answer[offset] != label_size) {
+      return false;
+    }
+    for (offset++; offset < label_end; offset++) {
+      if (LowerCase(query[offset]) != LowerCase(answer[offset])) {
+        return false;
+      }
+    }
+  }
+  // root label, QTYPE and QCLASS
+  auto end = offset + 1 + sizeof(uint16_t) * 2;
+  if (end > query.size() || end > answer_size) {
+    return false;
+  }
+  return std::equal(query.begin() + offset, query.begin() + end,
+                    answer + offset);
+}
+
+}  // namespace
+
+struct UdpResolver::TcpExchange {
+  explicit TcpExchange(boost::asio::io_context& io_context)
+      : socket(io_context), timer(io_context) {}
+  tcp::socket socket;
+  boost::asio::steady_timer timer;
+  QueryManager::QueryRecord record;
+  std::vector<uint8_t> buffer;
+  int16_t id;
+  bool finished = false;
+};
+
+UdpResolver::UdpResolver(const std::string& name,
+                         const udp_endpoints_type& endpoints)
+    : name_(name),
+      endpoints_(endpoints),
+      retransmit_timer_(Engine::get().GetExecutor()),
+      receive_buffer_(tcp_header_size +
+                      std::numeric_limits<uint16_t>::max()) {}
+
+void UdpResolver::Resolve(QueryContext::pointer& query,
+                          QueryResultHandler& handler) {
+  SentQuery sent;
+  sent.record = QueryManager::QueryRecord(query, handler);
+  if (id_allocator_.empty()) {
+    LOG_ERROR(<< name_ << " out of query IDs");
+    DropQuery(sent.record, boost::system::errc::make_error_code(
+                               boost::system::errc::no_buffer_space));
+    return;
+  }
+  sent.socket = SelectSocket();
+  sent.socket->queries_left--;
+  sent.socket->in_flight++;
+  Send(id_allocator_.Allocate(), std::move(sent));
+  WaitForRetransmit();
+}
+
+void UdpResolver::Close() {
+  retransmit_timer_.cancel();
+  retransmits_.clear();
+  error_code error;
+  for (auto& socket : sockets_) {
+    if (socket) {
+      socket->socket.close(error);
+      socket.reset();
+    }
+  }
+  // retired sockets live as long as their queries
+  sent_queries_.Drain([this](uint16_t id, SentQuery& sent) {
+    id_allocator_.Release(id);
+    error_code close_error;
+    sent.socket->socket.close(close_error);
+  });
+  for (auto& weak_exchange : tcp_exchanges_) {
+    if (auto exchange = weak_exchange.lock()) {
+      exchange->timer.cancel();
+      exchange->socket.close(error);
+    }
+  }
+  tcp_exchanges_.clear();
+}
+
+std::shared_ptr<UdpResolver::Socket>& UdpResolver::SelectSocket() {
+  auto& socket = sockets_[next_socket_];
+  next_socket_ = (next_socket_ + 1) % socket_count_;
+  if (!socket || !socket->queries_left || !socket->socket.is_open()) {
+    if (socket) {
+      RetireSocket(socket);
+    }
+    OpenSocket(socket);
+  }
+  return socket;
+}
+
+void UdpResolver::OpenSocket(std::shared_ptr<Socket>& socket) {
+  socket = std::make_shared<Socket>(Engine::get().GetExecutor());
+  socket->endpoint_index = current_endpoint_;
+  auto& endpoint = endpoints_[current_endpoint_];
+  // connect binds a random ephemeral port, and the kernel drops datagrams
+  // from other sources
+  error_code error;
+  socket->socket.open(endpoint.protocol(), error);
+  if (!error) {
+    socket->socket.connect(endpoint, error);
+  }
+  if (!error) {
+    socket->socket.non_blocking(true, error);
+  }
+  if (error) {
+    LOG_ERROR(<< name_ << " udp socket to " << endpoint
+              << " failed: " << error.message());
+    socket->socket.close(error);
+    return;
+  }
+  LOG_TRACE(<< name_ << " new udp socket "
+            << socket->socket.local_endpoint(error) << " to " << endpoint);
+  DoReceive(socket);
+}
+
+void UdpResolver::RetireSocket(const std::shared_ptr<Socket>& socket) {
+  socket->retired = true;
+  if (!socket->in_flight) {
+    error_code error;
+    socket->socket.close(error);
+  }
+}
+
+void UdpResolver::ReleaseSocket(Socket& socket) {
+  socket.in_flight--;
+  if (socket.retired && !socket.in_flight) {
+    error_code error;
+    socket.socket.close(error);
+  }
+}
+
+void UdpResolver::DoReceive(std::shared_ptr<Socket> socket) {
+  socket->socket.async_wait(
+      udp::socket::wait_read, [this, socket](const error_code& error) {
+        if (error) {
+          // closed
+          return;
+        }
+        while (socket->socket.is_open()) {
+          error_code receive_error;
+          auto size = socket->socket.receive(
+              boost::asio::buffer(receive_buffer_.data() + tcp_header_size,
+                                  receive_buffer_.size() - tcp_header_size),
+              0, receive_error);
+          if (receive_error == boost::asio::error::would_block) {
+            break;
+          }
+          if (receive_error) {
+            LOG_DEBUG(<< name_ << " receive failed: "
+                      << receive_error.message());
+            // port unreachable of a connected socket is reported once
+            if (receive_error == boost::asio::error::connection_refused) {
+              continue;
+            }
+            // queries on the socket are sent again on another one
+            socket->socket.close(receive_error);
+            break;
+          }
+          HandleAnswer(*socket, size);
+        }
+        if (socket->socket.is_open()) {
+          DoReceive(socket);
+        }
+      });
+}
+
+void UdpResolver::HandleAnswer(Socket& socket, size_t size) {
+  auto data = receive_buffer_.data();
+  if (size < sizeof(dns::RawHeader)) {
+    LOG_DEBUG(<< name_ << " short answer dropped");
+    return;
+  }
+  reinterpret_cast<dns::RawTcpMessage*>(data)->message_length =
+      endian::native_to_big(static_cast<uint16_t>(size));
+  size += tcp_header_size;
+  int16_t raw_id;
+  dns::MessageDecoder::ReadIDFromTcpMessage(data, size, raw_id);
+  uint16_t id = raw_id;
+  SentQuery sent;
+  if (!sent_queries_.Extract(id, sent)) {
+    LOG_DEBUG(<< name_ << " answer " << id << " matches no query");
+    return;
+  }
+  if (sent.socket.get() != &socket ||
+      !QuestionMatches(sent.record.first->raw_message, data, size)) {
+    // a late answer to a query sent again on another socket, or a forged
+    // one, the query keeps waiting
+    LOG_DEBUG(<< name_ << " answer " << id << " does not match its query");
+    sent_queries_.Insert(id, std::move(sent));
+    return;
+  }
+  id_allocator_.Release(id);
+  ReleaseSocket(socket);
+
+  auto& context = sent.record.first;
+  if (context->status != QueryContext::Status::WAITING_FOR_ANSWER) {
+    DropQuery(sent.record, error_code());
+    return;
+  }
+  auto& header = *reinterpret_cast<const dns::RawHeader*>(
+      data + tcp_header_size);
+  if (header.FLAGS & dns::RawHeader::Flag::TC_mask) {
+    LOG_DEBUG(<< name_ << " answer " << id << " truncated, query over tcp");
+    ResolveOverTcp(std::move(sent.record));
+    return;
+  }
+  context->raw_message.assign(data, data + size);
+  dns::MessageEncoder::RewriteIDToTcpMessage(
+      context->raw_message.data(), size, context->query.header.id);
+  context->status = QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER;
+  LOG_TRACE(<< name_ << " " << context->query.header.id << "|" << id
+            << " answered");
+  sent.record.second(std::move(sent.record.first),
+                     boost::system::errc::make_error_code(
+                         boost::system::errc::success));
+}
+
+void UdpResolver::Send(uint16_t id, SentQuery&& sent) {
+  auto& context = *sent.record.first;
+  auto& raw_message = context.raw_message;
+  // the context is shared with other resolvers, which rewrite the ID as well
+  auto encode_result = dns::MessageEncoder::RewriteIDToTcpMessage(
+      raw_message.data(), raw_message.size(), id);
+  if (encode_result != dns::MessageEncoder::ResultType::good) {
+    id_allocator_.Release(id);
+    ReleaseSocket(*sent.socket);
+    DropQuery(sent.record, boost::system::errc::make_error_code(
+                               boost::system::errc::bad_message));
+    return;
+  }
+  LOG_TRACE(<< name_ << " query "
+            << (context.query.questions.size() ? context.query.questions[0].name
+                                                : "")
+            << "|" << id << " attempt " << sent.attempts + 1);
+  error_code error;
+  sent.socket->socket.send(
+      boost::asio::buffer(raw_message.data() + tcp_header_size,
+                          raw_message.size() - tcp_header_size),
+      0, error);
+  if (error) {
+    // treated as a lost datagram
+    LOG_DEBUG(<< name_ << " send failed: " << error.message());
+  }
+  sent.attempts++;
+  retransmits_.push_back(
+      {steady_clock::now() + retransmit_interval_, id, &context});
+  sent_queries_.Insert(id, std::move(sent));
+}
+
+void UdpResolver::WaitForRetransmit() {
+  if (retransmit_timer_waiting_ || retransmits_.empty()) {
+    return;
+  }
+  retransmit_timer_waiting_ = true;
+  retransmit_timer_.expires_at(retransmits_.front().deadline);
+  retransmit_timer_.async_wait([this](const error_code& error) {
+    retransmit_timer_waiting_ = false;
+    if (!error) {
+      Retransmit();
+    }
+  });
+}
+
+void UdpResolver::Retransmit() {
+  auto now = steady_clock::now();
+  while (!retransmits_.empty() && retransmits_.front().deadline <= now) {
+    auto entry = retransmits_.front();
+    retransmits_.pop_front();
+    SentQuery sent;
+    if (!sent_queries_.Extract(entry.id, sent)) {
+      // answered
+      continue;
+    }
+    if (sent.record.first.get() != entry.context) {
+      // the ID went to another query
+      sent_queries_.Insert(entry.id, std::move(sent));
+      continue;
+    }
+    auto status = sent.record.first->status;
+    if (status != QueryContext::Status::WAITING_FOR_ANSWER ||
+        sent.attempts >= max_attempts_) {
+      id_allocator_.Release(entry.id);
+      ReleaseSocket(*sent.socket);
+      if (status == QueryContext::Status::WAITING_FOR_ANSWER &&
+          endpoints_.size() > 1 &&
+          sent.socket->endpoint_index == current_endpoint_) {
+        // new sockets go to the next endpoint
+        current_endpoint_ = (current_endpoint_ + 1) % endpoints_.size();
+        LOG_INFO(<< name_ << " not answering, switch to "
+                 << endpoints_[current_endpoint_]);
+        for (auto& socket : sockets_) {
+          if (socket) {
+            RetireSocket(socket);
+            socket.reset();
+          }
+        }
+      }
+      DropQuery(sent.record, boost::asio::error::timed_out);
+      continue;
+    }
+    if (!sent.socket->socket.is_open()) {
+      ReleaseSocket(*sent.socket);
+      sent.socket = SelectSocket();
+      sent.socket->queries_left--;
+      sent.socket->in_flight++;
+    }
+    Send(entry.id, std::move(sent));
+  }
+  WaitForRetransmit();
+}
+
+void UdpResolver::ResolveOverTcp(QueryManager::QueryRecord&& record) {
+  auto exchange = std::make_shared<TcpExchange>(Engine::get().GetExecutor());
+  exchange->record = std::move(record);
+  // other resolvers may rewrite the ID of the raw query meanwhile
+  exchange->buffer = exchange->record.first->raw_message;
+  dns::MessageDecoder::ReadIDFromTcpMessage(
+      exchange->buffer.data(), exchange->buffer.size(), exchange->id);
+  tcp_exchanges_.erase(
+      std::remove_if(tcp_exchanges_.begin(), tcp_exchanges_.end(),
+                     [](const std::weak_ptr<TcpExchange>& weak_exchange) {
+                       return weak_exchange.expired();
+                     }),
+      tcp_exchanges_.end());
+  tcp_exchanges_.push_back(exchange);
+
+  exchange->timer.expires_after(tcp_timeout_);
+  exchange->timer.async_wait([exchange](const error_code& error) {
+    if (!error) {
+      error_code close_error;
+      exchange->socket.close(close_error);
+    }
+  });
+  auto& endpoint = endpoints_[current_endpoint_];
+  exchange->socket.async_connect(
+      tcp::endpoint(endpoint.address(), endpoint.port()),
+      [this, exchange](const error_code& error) {
+        if (error) {
+          FinishTcpExchange(*exchange, error);
+          return;
+        }
+        async_write(
+            exchange->socket, boost::asio::buffer(exchange->buffer),
+            [this, exchange](const error_code& error, size_t /*size*/) {
+              if (error) {
+                FinishTcpExchange(*exchange, error);
+                return;
+              }
+              exchange->buffer.resize(tcp_header_size);
+              async_read(
+                  exchange->socket, boost::asio::buffer(exchange->buffer),
+                  [this, exchange](const error_code& error, size_t /*size*/) {
+                    auto message_size = endian::big_to_native(
+                        reinterpret_cast<dns::RawTcpMessage*>(
+                            exchange->buffer.data())
+                            ->message_length);
+                    if (error || message_size < sizeof(dns::RawHeader)) {
+                      FinishTcpExchange(
+                          *exchange,
+                          error ? error
+                                : boost::system::errc::make_error_code(
+                                      boost::system::errc::bad_message));
+                      return;
+                    }
+                    exchange->buffer.resize(tcp_header_size + message_size);
+                    async_read(exchange->socket,
+                               boost::asio::buffer(
+                                   exchange->buffer.data() + tcp_header_size,
+                                   message_size),
+                               [this, exchange](const error_code& error,
+                                                size_t /*size*/) {
+                                 FinishTcpExchange(*exchange, error);
+                               });
+                  });
+            });
+      });
+}
+
+void UdpResolver::FinishTcpExchange(TcpExchange& exchange,
+                                    const error_code& error) {
+  if (exchange.finished) {
+    return;
+  }
+  exchange.finished = true;
+  exchange.timer.cancel();
+  error_code close_error;
+  exchange.socket.close(close_error);
+
+  auto& record = exchange.record;
+  if (error) {
+    LOG_DEBUG(<< name_ << " query over tcp failed: " << error.message());
+    DropQuery(record, error);
+    return;
+  }
+  int16_t id;
+  dns::MessageDecoder::ReadIDFromTcpMessage(exchange.buffer.data(),
+                                            exchange.buffer.size(), id);
+  if (id != exchange.id) {
+    DropQuery(record, boost::system::errc::make_error_code(
+                          boost::system::errc::bad_message));
+    return;
+  }
+  if (record.first->status != QueryContext::Status::WAITING_FOR_ANSWER) {
+    DropQuery(record, error);
+    return;
+  }
+  auto& context = record.first;
+  context->raw_message = std::move(exchange.buffer);
+  dns::MessageEncoder::RewriteIDToTcpMessage(context->raw_message.data(),
+                                             context->raw_message.size(),
+                                             context->query.header.id);
+  context->status = QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER;
+  record.second(std::move(record.first), boost::system::errc::make_error_code(
+                                             boost::system::errc::success));
+}
+
+void UdpResolver::DropQuery(QueryManager::QueryRecord& record,
+                            error_code error) {
+  switch (record.first->status) {
+    case QueryContext::Status::EXPIRED:
+      error = boost::asio::error::timed_out;
+      break;
+    case QueryContext::Status::ANSWER_WRITTERN_TO_BUFFER:
+      // Got error during resolving
+    case QueryContext::Status::ANSWER_ACCEPTED:
+      // Already resolved by another resolver
+      error = boost::system::errc::make_error_code(
+          boost::system::errc::operation_canceled);
+      break;
+    default:
+      break;
+  }
+  record.second(std::move(record.first), error);
+}
+
+}  // namespace dnstoy
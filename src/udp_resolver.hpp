@@ -0,0 +1,100 @@
+#ifndef DNSTOY_UDP_RESOLVER_H_
+#define DNSTOY_UDP_RESOLVER_H_
+#include <array>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "in_flight_table.hpp"
+#include "query.hpp"
+#include "query_id_allocator.hpp"
+
+namespace dnstoy {
+
+// Plain DNS over UDP, for remote servers on trusted networks.
+// Queries share a few connected sockets. Every socket is replaced by one on a
+// new random source port after socket_query_limit_ queries, and IDs are
+// random and unique among all sockets (rfc5452 9.2). Answers must come back
+// on the socket of the query with the same question. Unanswered queries are
+// sent again every retransmit_interval_, truncated answers are queried
+// again over TCP (rfc7766 5).
+// thread-unsafe, designed for thread_local use
+class UdpResolver {
+ public:
+  using udp_endpoints_type = std::vector<boost::asio::ip::udp::endpoint>;
+  UdpResolver(const std::string& name, const udp_endpoints_type& endpoints);
+  void Resolve(QueryContext::pointer& query, QueryResultHandler& handler);
+  void Close();
+
+ private:
+  using udp = boost::asio::ip::udp;
+  using tcp = boost::asio::ip::tcp;
+  struct Socket {
+    explicit Socket(boost::asio::io_context& io_context)
+        : socket(io_context) {}
+    udp::socket socket;
+    size_t endpoint_index = 0;
+    size_t queries_left = socket_query_limit_;
+    // queries waiting for answers on this socket
+    size_t in_flight = 0;
+    // no new query is sent, closed once in_flight drops to 0
+    bool retired = false;
+  };
+  struct SentQuery {
+    QueryManager::QueryRecord record;
+    std::shared_ptr<Socket> socket;
+    size_t attempts = 0;
+  };
+  // in send order, so the front is always the next to retransmit
+  struct RetransmitEntry {
+    std::chrono::steady_clock::time_point deadline;
+    uint16_t id;
+    const QueryContext* context;
+  };
+  struct TcpExchange;
+
+  static constexpr size_t socket_count_ = 4;
+  static constexpr size_t socket_query_limit_ = 256;
+  static constexpr std::chrono::milliseconds retransmit_interval_{1000};
+  static constexpr size_t max_attempts_ = 3;
+  static constexpr std::chrono::seconds tcp_timeout_{5};
+
+  std::string name_;
+  udp_endpoints_type endpoints_;
+  // queries go to this endpoint, the next one is used once a query is never
+  // answered
+  size_t current_endpoint_ = 0;
+  std::array<std::shared_ptr<Socket>, socket_count_> sockets_;
+  size_t next_socket_ = 0;
+  QueryIdAllocator id_allocator_;
+  InFlightTable<SentQuery> sent_queries_;
+  std::deque<RetransmitEntry> retransmits_;
+  boost::asio::steady_timer retransmit_timer_;
+  bool retransmit_timer_waiting_ = false;
+  std::vector<std::weak_ptr<TcpExchange>> tcp_exchanges_;
+  // answers are received behind a tcp length field, ready to be handed out
+  // as raw tcp messages
+  std::vector<uint8_t> receive_buffer_;
+
+  std::shared_ptr<Socket>& SelectSocket();
+  void OpenSocket(std::shared_ptr<Socket>& socket);
+  void RetireSocket(const std::shared_ptr<Socket>& socket);
+  void ReleaseSocket(Socket& socket);
+  void DoReceive(std::shared_ptr<Socket> socket);
+  void HandleAnswer(Socket& socket, size_t size);
+  void Send(uint16_t id, SentQuery&& sent);
+  void WaitForRetransmit();
+  void Retransmit();
+  void ResolveOverTcp(QueryManager::QueryRecord&& record);
+  void FinishTcpExchange(TcpExchange& exchange,
+                         const boost::system::error_code& error);
+  void DropQuery(QueryManager::QueryRecord& record,
+                 boost::system::error_code error);
+};
+
+}  // namespace dnstoy
+#endif  // DNSTOY_UDP_RESOLVER_H_
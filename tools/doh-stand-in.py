@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+# A local DNS over HTTPS (rfc8484) server on HTTP/2 for testing the https
+# transport, python standard library only.
+# Every A query is answered with 192.0.2.1, names starting with "big" get an
+# answer larger than a DNS message can be, names starting with "zero" a DATA
+# frame on stream 0 the first time they are asked, a connection error.
+# Requests to another path than --path get 404.
+import argparse
+import asyncio
+import ssl
+import struct
+import sys
+
+# rfc7540 6
+DATA, HEADERS, RST_STREAM, SETTINGS, PING, GOAWAY, WINDOW_UPDATE = (
+    0x0, 0x1, 0x3, 0x4, 0x6, 0x7, 0x8)
+END_STREAM, ACK, END_HEADERS, PADDED, PRIORITY = 0x1, 0x1, 0x4, 0x8, 0x20
+MAX_CONCURRENT_STREAMS = 0x3
+PREFACE = b'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n'
+MAX_FRAME_SIZE = 16384
+
+# names starting with "zero" asked so far, on any connection
+zero_asked = set()
+
+# rfc7541 appendix A, the names the client sends by index
+STATIC_NAMES = {1: ':authority', 2: ':method', 3: ':method', 4: ':path',
+                5: ':path', 6: ':scheme', 7: ':scheme', 19: 'accept',
+                28: 'content-length', 31: 'content-type'}
+
+
+def log(*values):
+    print(*values, file=sys.stderr, flush=True)
+
+
+def decode_integer(block, offset, prefix_bits):
+    prefix_max = (1 << prefix_bits) - 1
+    value = block[offset] & prefix_max
+    offset += 1
+    if value < prefix_max:
+        return value, offset
+    shift = 0
+    while True:
+        byte = block[offset]
+        offset += 1
+        value += (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, offset
+
+
+def decode_string(block, offset):
+    if block[offset] & 0x80:
+        raise ValueError('Huffman encoded strings are not supported')
+    size, offset = decode_integer(block, offset, 7)
+    return block[offset:offset + size].decode(), offset + size
+
+
+def decode_headers(block):
+    # the client sends static indexes and literals never added to the
+    # dynamic table
+    headers = {}
+    offset = 0
+    while offset < len(block):
+        first_byte = block[offset]
+        if first_byte & 0x80:
+            index, offset = decode_integer(block, offset, 7)
+            name = STATIC_NAMES.get(index)
+            value = {2: 'GET', 3: 'POST', 4: '/', 6: 'http', 7: 'https'}.get(
+                index, '')
+        else:
+            prefix_bits = 6 if first_byte & 0x40 else 4
+            index, offset = decode_integer(block, offset, prefix_bits)
+            if index:
+                name = STATIC_NAMES.get(index, str(index))
+            else:
+                name, offset = decode_string(block, offset)
+            value, offset = decode_string(block, offset)
+        headers[name] = value
+    return headers
+
+
+def encode_headers(status):
+    if status == 200:
+        # indexed :status 200
+        block = b'\x88'
+    else:
+        # literal, name :status
+        block = b'\x08' + bytes([len(str(status))]) + str(status).encode()
+    media_type = b'application/dns-message'
+    # literal, name content-type
+    return block + b'\x0f\x10' + bytes([len(media_type)]) + media_type
+
+
+def answer(query):
+    offset = 12
+    labels = []
+    while query[offset]:
+        size = query[offset]
+        labels.append(query[offset + 1:offset + 1 + size])
+        offset += 1 + size
+    question_end = offset + 5
+    count = 5000 if labels and labels[0].startswith(b'big') else 1
+    record = b'\xc0\x0c' + struct.pack('>HHIH', 1, 1, 60, 4) + bytes(
+        [192, 0, 2, 1])
+    # QR, RD and RA set, one question
+    header = query[:2] + struct.pack('>HHHHH', 0x8180, 1, count, 0, 0)
+    return header + query[12:question_end] + record * count
+
+
+class Connection:
+    def __init__(self, reader, writer, options):
+        self.reader = reader
+        self.writer = writer
+        self.options = options
+        self.requests = {}
+
+    def frame(self, frame_type, flags, stream_id, payload=b''):
+        self.writer.write(
+            struct.pack('>I', len(payload))[1:] +
+            bytes([frame_type, flags]) + struct.pack('>I', stream_id) +
+            payload)
+
+    def respond(self, stream_id):
+        headers, body = self.requests.pop(stream_id)
+        if headers.get(':path') != self.options.path:
+            log('stream', stream_id, 'path', headers.get(':path'), '404')
+            self.frame(HEADERS, END_HEADERS | END_STREAM, stream_id,
+                       encode_headers(404))
+            return
+        message = answer(body)
+        name = message[12:message.index(b'\0', 12)]
+        if name[1:5] == b'zero' and name not in zero_asked:
+            zero_asked.add(name)
+            self.frame(DATA, 0, 0)
+        self.frame(HEADERS, END_HEADERS, stream_id, encode_headers(200))
+        for offset in range(0, len(message), MAX_FRAME_SIZE):
+            chunk = message[offset:offset + MAX_FRAME_SIZE]
+            last = offset + MAX_FRAME_SIZE >= len(message)
+            self.frame(DATA, END_STREAM if last else 0, stream_id, chunk)
+        log('stream', stream_id, 'answered', len(message), 'bytes')
+
+    async def run(self):
+        if await self.reader.readexactly(len(PREFACE)) != PREFACE:
+            raise ValueError('bad connection preface')
+        self.frame(SETTINGS, 0, 0, struct.pack(
+            '>HI', MAX_CONCURRENT_STREAMS,
+            self.options.max_concurrent_streams))
+        while True:
+            header = await self.reader.readexactly(9)
+            length = int.from_bytes(header[:3], 'big')
+            frame_type, flags = header[3], header[4]
+            stream_id = struct.unpack('>I', header[5:])[0] & 0x7fffffff
+            payload = await self.reader.readexactly(length)
+            if frame_type == SETTINGS and not flags & ACK:
+                self.frame(SETTINGS, ACK, 0)
+            elif frame_type == PING and not flags & ACK:
+                self.frame(PING, ACK, 0, payload)
+            elif frame_type == HEADERS:
+                self.requests[stream_id] = (decode_headers(payload), b'')
+                if flags & END_STREAM:
+                    self.respond(stream_id)
+            elif frame_type == DATA and stream_id in self.requests:
+                headers, body = self.requests[stream_id]
+                self.requests[stream_id] = (headers, body + payload)
+                if flags & END_STREAM:
+                    self.respond(stream_id)
+            elif frame_type == RST_STREAM:
+                log('stream', stream_id, 'reset by client, error',
+                    struct.unpack('>I', payload)[0])
+            elif frame_type == GOAWAY:
+                return
+            await self.writer.drain()
+
+
+async def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--address', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=8443)
+    parser.add_argument('--cert', required=True, help='PEM certificate')
+    parser.add_argument('--key', required=True, help='PEM private key')
+    parser.add_argument('--path', default='/dns-query')
+    parser.add_argument('--max-concurrent-streams', type=int, default=100)
+    options = parser.parse_args()
+
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(options.cert, options.key)
+    context.set_alpn_protocols(['h2'])
+
+    async def handle(reader, writer):
+        try:
+            await Connection(reader, writer, options).run()
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        writer.close()
+
+    server = await asyncio.start_server(handle, options.address, options.port,
+                                        ssl=context)
+    log('listening on', options.address, options.port)
+    async with server:
+        await server.serve_forever()
+
+
+if __name__ == '__main__':
+    asyncio.run(main())
@@ -0,0 +1,49 @@
+#!/bin/bash
+# Resolves through the https transport of dnstoy against the local DNS over
+# HTTPS stand-in, trusted by a private CA given as tls-ca-file.
+# usage: tools/test-doh.sh [path of dnstoy, default build/dnstoy]
+set -e
+tools=$(cd "$(dirname "$0")" && pwd)
+dnstoy=$(realpath "${1:-build/dnstoy}")
+listen_port=25353
+doh_port=28443
+work=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null; rm -rf "$work"' EXIT
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=doh.test \
+  -addext subjectAltName=DNS:doh.test -keyout "$work/key.pem" \
+  -out "$work/cert.pem" 2>/dev/null
+cat > "$work/dnstoy.conf" <<CONF
+listen-address=127.0.0.1
+listen-port=$listen_port
+remote-servers=https@$doh_port/127.0.0.1/doh.test/test/dns-query
+tls-ca-file=$work/cert.pem
+keep-warm-servers=0
+cache-memory-limit=0
+CONF
+
+"$tools/doh-stand-in.py" --port $doh_port --cert "$work/cert.pem" \
+  --key "$work/key.pem" --path /test/dns-query 2> "$work/stand-in.log" &
+"$dnstoy" --config "$work/dnstoy.conf" > "$work/dnstoy.log" 2>&1 &
+sleep 1
+
+python3 - $listen_port <<'PY'
+import random, socket, struct, sys
+
+def query(name):
+    query_id = random.randrange(1 << 16)
+    message = struct.pack('>HHHHHH', query_id, 0x0100, 1, 0, 0, 0)
+    message += b''.join(bytes([len(label)]) + label.encode()
+                        for label in name.split('.'))
+    message += b'\0' + struct.pack('>HH', 1, 1)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(3)
+    sock.sendto(message, ('127.0.0.1', int(sys.argv[1])))
+    answer = sock.recv(65536)
+    assert answer[:2] == message[:2], 'id mismatch'
+    assert answer[-4:] == bytes([192, 0, 2, 1]), 'unexpected answer'
+
+for name in ['a.example', 'b.example', 'c.example']:
+    query(name)
+    print(name, 'ok')
+PY